@@ -0,0 +1,63 @@
+// Hash throughput benchmark.
+// Measures XXH64 over packet-sized chunks, the way both ends feed it during a
+// transfer, and compares the result with the fastest supported link.
+
+#include "hash.h"
+#include "link_layer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BUFFER_SIZE (64 * 1024 * 1024)
+#define REPETITIONS 5
+#define LINK_BYTES_PER_SECOND (4000000.0 / 10) // 4 Mbaud, 10 bits per byte
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned char *buffer = malloc(BUFFER_SIZE);
+    if (buffer == NULL) return 1;
+
+    srand(1);
+    for (size_t i = 0; i < BUFFER_SIZE; i++) buffer[i] = rand();
+
+    const size_t chunks[] = {MAX_PAYLOAD_SIZE, 64 * 1024, BUFFER_SIZE};
+    uint64_t digest = 0;
+
+    printf("%12s %12s %12s\n", "chunk", "MB/s", "x link");
+
+    for (int c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        double best = 0;
+
+        // first repetition warms caches and page tables
+        for (int r = 0; r <= REPETITIONS; r++) {
+            HashState state;
+            double start = now();
+
+            hashInit(&state);
+            for (size_t pos = 0; pos < BUFFER_SIZE; pos += chunks[c]) {
+                size_t n = BUFFER_SIZE - pos < chunks[c] ? BUFFER_SIZE - pos : chunks[c];
+                hashUpdate(&state, buffer + pos, n);
+            }
+            digest += hashDigest(&state);
+
+            double rate = BUFFER_SIZE / (now() - start);
+            if (r > 0 && rate > best) best = rate;
+        }
+
+        printf("%12zu %12.1f %12.0f\n", chunks[c], best / 1e6, best / LINK_BYTES_PER_SECOND);
+    }
+
+    // keep the hashing from being optimised away
+    printf("\ndigest check: %016llx\n", (unsigned long long) digest);
+
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,434 @@
+// Framing kernel microbenchmark.
+// Times each inner loop of the link on its own: byte stuffing, destuffing,
+// the BCC2 XOR and the frame parser, over random bytes, all-FLAG bytes, text
+// and a real file (penguin.gif by default). Every kernel has a reference
+// variant and the others must produce exactly the same output, so a faster
+// variant is only reported if it is also correct.
+
+#include "frame_parser.h"
+#include "hash.h"
+#include "link_layer.h"
+#include "packet_pool.h"
+#include "protocol.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#define UNIT "cycles/B"
+#else
+#define CYCLES() nowNs()
+#define UNIT "ns/B"
+#endif
+
+#define INPUT_SIZE (4 * 1024 * 1024)
+#define WARMUP 1
+#define REPETITIONS 5
+
+// Frame of the production link layer, defined in link_layer.c
+unsigned char *buildFrame(unsigned char A, unsigned char C, const unsigned char *buf, int bufSize, int *frameSize);
+
+typedef struct {
+    const char *kernel;
+    const char *variant;
+    // Process n input bytes into out, returning the output size
+    size_t (*run)(const unsigned char *in, size_t n, unsigned char *out);
+    int stuffedInput; // takes the stuffed frames instead of the raw input
+} Variant;
+
+static unsigned long long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline size_t chunkSize(size_t pos, size_t n)
+{
+    return n - pos < MAX_PAYLOAD_SIZE ? n - pos : MAX_PAYLOAD_SIZE;
+}
+
+//////////////////////////////////////////////
+// Stuffing (one I-frame per payload)
+//////////////////////////////////////////////
+
+static const unsigned char special[256] = {[FLAG] = 1, [ESC] = 1};
+
+// The loop of buildFrame, byte by byte through a switch
+static size_t stuffSwitch(const unsigned char *in, size_t n, unsigned char *out)
+{
+    unsigned char *w = out;
+
+    for (size_t pos = 0; pos < n; pos += MAX_PAYLOAD_SIZE) {
+        size_t size = chunkSize(pos, n);
+        unsigned char BCC2 = 0;
+
+        *w++ = FLAG;
+        *w++ = A_T;
+        *w++ = C_INF(0);
+        *w++ = A_T ^ C_INF(0);
+
+        for (size_t i = 0; i <= size; i++) {
+            unsigned char byte = i < size ? in[pos + i] : BCC2;
+            if (i < size) BCC2 ^= byte;
+
+            switch (byte) {
+                case FLAG:
+                    *w++ = ESC;
+                    *w++ = SUF_FLAG;
+                    break;
+
+                case ESC:
+                    *w++ = ESC;
+                    *w++ = SUF_ESC;
+                    break;
+
+                default:
+                    *w++ = byte;
+                    break;
+            }
+        }
+
+        *w++ = FLAG;
+    }
+
+    return w - out;
+}
+
+// XOR of a payload, 8 bytes at a time
+static unsigned char xorWords(const unsigned char *in, size_t n)
+{
+    uint64_t acc = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, in + i, 8);
+        acc ^= word;
+    }
+
+    acc ^= acc >> 32;
+    acc ^= acc >> 16;
+    acc ^= acc >> 8;
+
+    unsigned char BCC2 = acc;
+    for (; i < n; i++) BCC2 ^= in[i];
+
+    return BCC2;
+}
+
+// Copy runs of plain bytes with memcpy and compute BCC2 a word at a time
+static size_t stuffRuns(const unsigned char *in, size_t n, unsigned char *out)
+{
+    unsigned char *w = out;
+
+    for (size_t pos = 0; pos < n; pos += MAX_PAYLOAD_SIZE) {
+        const unsigned char *p = in + pos, *end = p + chunkSize(pos, n);
+        unsigned char BCC2 = xorWords(p, end - p);
+
+        *w++ = FLAG;
+        *w++ = A_T;
+        *w++ = C_INF(0);
+        *w++ = A_T ^ C_INF(0);
+
+        while (p < end) {
+            const unsigned char *run = p;
+            while (p < end && !special[*p]) p++;
+
+            memcpy(w, run, p - run);
+            w += p - run;
+
+            if (p < end) {
+                *w++ = ESC;
+                *w++ = *p++ ^ 0x20;
+            }
+        }
+
+        if (special[BCC2]) {
+            *w++ = ESC;
+            *w++ = BCC2 ^ 0x20;
+        }
+        else *w++ = BCC2;
+
+        *w++ = FLAG;
+    }
+
+    return w - out;
+}
+
+// buildFrame itself, including its pool allocation
+static size_t stuffBuildFrame(const unsigned char *in, size_t n, unsigned char *out)
+{
+    unsigned char *w = out;
+
+    for (size_t pos = 0; pos < n; pos += MAX_PAYLOAD_SIZE) {
+        int frameSize = 0;
+        unsigned char *frame = buildFrame(A_T, C_INF(0), in + pos, chunkSize(pos, n), &frameSize);
+        if (frame == NULL) return 0;
+
+        memcpy(w, frame, frameSize);
+        w += frameSize;
+        poolFree(frame);
+    }
+
+    return w - out;
+}
+
+//////////////////////////////////////////////
+// Destuffing (information field of each frame)
+//////////////////////////////////////////////
+
+// The destuffing() llread used before the table-driven parser, in place
+static int destuffInPlace(unsigned char *buf, int bufSize)
+{
+    unsigned char *r = buf, *w = buf;
+
+    while (r < buf + bufSize) {
+        if (*r != ESC) *w++ = *r++;
+        else {
+            if (*(r + 1) == SUF_FLAG) *w++ = FLAG;
+            else if (*(r + 1) == SUF_ESC) *w++ = ESC;
+            r += 2;
+        }
+    }
+
+    return w - buf;
+}
+
+// Copy each field out, then destuff it in place (BCC2 dropped)
+static size_t destuffTwoPass(const unsigned char *in, size_t n, unsigned char *out)
+{
+    unsigned char *w = out;
+
+    for (const unsigned char *p = in; p < in + n;) {
+        const unsigned char *field = p + 4;
+        const unsigned char *flag = memchr(field, FLAG, in + n - field);
+
+        memcpy(w, field, flag - field);
+        w += destuffInPlace(w, flag - field) - 1;
+        p = flag + 1;
+    }
+
+    return w - out;
+}
+
+// One pass: memchr to the next ESC, memcpy the run before it (BCC2 dropped)
+static size_t destuffRuns(const unsigned char *in, size_t n, unsigned char *out)
+{
+    unsigned char *w = out;
+
+    for (const unsigned char *p = in; p < in + n;) {
+        const unsigned char *field = p + 4;
+        const unsigned char *flag = memchr(field, FLAG, in + n - field);
+        unsigned char *start = w;
+
+        for (const unsigned char *r = field; r < flag;) {
+            const unsigned char *esc = memchr(r, ESC, flag - r);
+            if (esc == NULL) esc = flag;
+
+            memcpy(w, r, esc - r);
+            w += esc - r;
+            r = esc;
+
+            if (r < flag) {
+                *w++ = r[1] ^ 0x20;
+                r += 2;
+            }
+        }
+
+        if (w > start) w--;
+        p = flag + 1;
+    }
+
+    return w - out;
+}
+
+//////////////////////////////////////////////
+// BCC2 (one byte per payload)
+//////////////////////////////////////////////
+
+static size_t bccBytes(const unsigned char *in, size_t n, unsigned char *out)
+{
+    size_t frames = 0;
+
+    for (size_t pos = 0; pos < n; pos += MAX_PAYLOAD_SIZE) {
+        unsigned char BCC2 = 0;
+        for (size_t i = pos; i < pos + chunkSize(pos, n); i++) BCC2 ^= in[i];
+        out[frames++] = BCC2;
+    }
+
+    return frames;
+}
+
+static size_t bccWords(const unsigned char *in, size_t n, unsigned char *out)
+{
+    size_t frames = 0;
+
+    for (size_t pos = 0; pos < n; pos += MAX_PAYLOAD_SIZE) {
+        out[frames++] = xorWords(in + pos, chunkSize(pos, n));
+    }
+
+    return frames;
+}
+
+//////////////////////////////////////////////
+// Parsing (whole frames, payload kept)
+//////////////////////////////////////////////
+
+static size_t parseChunks(const unsigned char *in, size_t n, unsigned char *out, size_t chunk)
+{
+    FrameParser parser;
+    unsigned char *w = out;
+    parserInit(&parser, w, MAX_PAYLOAD_SIZE + 1);
+
+    for (size_t pos = 0; pos < n;) {
+        size_t len = n - pos < chunk ? n - pos : chunk;
+        Frame frame;
+        int consumed = 0;
+
+        if (parserFeed(&parser, in + pos, len, &consumed, &frame) && frame.bcc2Ok && frame.size > 0) {
+            w += frame.size;
+            parserSetBuffer(&parser, w, MAX_PAYLOAD_SIZE + 1);
+        }
+        pos += consumed;
+    }
+
+    return w - out;
+}
+
+// Fed in serial port sized reads, as nextFrame does
+static size_t parseTable(const unsigned char *in, size_t n, unsigned char *out)
+{
+    return parseChunks(in, n, out, 4096);
+}
+
+// Fed one byte per call, as with readByteSerialPort
+static size_t parseBytewise(const unsigned char *in, size_t n, unsigned char *out)
+{
+    return parseChunks(in, n, out, 1);
+}
+
+//////////////////////////////////////////////
+// Harness
+//////////////////////////////////////////////
+
+// The first variant of each kernel is its reference
+static const Variant variants[] = {
+    {"stuff", "switch", stuffSwitch, 0},
+    {"stuff", "runs", stuffRuns, 0},
+    {"stuff", "buildFrame", stuffBuildFrame, 0},
+    {"destuff", "two-pass", destuffTwoPass, 1},
+    {"destuff", "runs", destuffRuns, 1},
+    {"bcc2", "bytes", bccBytes, 0},
+    {"bcc2", "words", bccWords, 0},
+    {"parse", "table", parseTable, 1},
+    {"parse", "table-bytewise", parseBytewise, 1},
+};
+
+static void fillText(unsigned char *buf, size_t n)
+{
+    static const char *words[] = {"the", "link", "layer", "frames", "each", "packet", "with", "a",
+                                  "header", "and", "checks", "it", "before", "sending", "data", "to"};
+    size_t pos = 0;
+
+    while (pos < n) {
+        const char *word = words[rand() % 16];
+        for (size_t i = 0; word[i] != '\0' && pos < n; i++) buf[pos++] = word[i];
+        if (pos < n) buf[pos++] = rand() % 12 == 0 ? '\n' : ' ';
+    }
+}
+
+// Fill buf with the contents of a file, repeated
+static int fillFile(unsigned char *buf, size_t n, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return -1;
+
+    size_t size = fread(buf, 1, n, file);
+    fclose(file);
+    if (size == 0) return -1;
+
+    for (size_t pos = size; pos < n; pos++) buf[pos] = buf[pos - size];
+    return 1;
+}
+
+static uint64_t digest(const unsigned char *buf, size_t n)
+{
+    HashState state;
+    hashInit(&state);
+    hashUpdate(&state, buf, n);
+    return hashDigest(&state);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "penguin.gif";
+    const char *inputs[] = {"random", "all-FLAG", "text", path};
+    size_t outSize = 2 * INPUT_SIZE + 8 * (INPUT_SIZE / MAX_PAYLOAD_SIZE + 1);
+
+    unsigned char *input = malloc(INPUT_SIZE);
+    unsigned char *stuffed = malloc(outSize);
+    unsigned char *out = malloc(outSize);
+    if (input == NULL || stuffed == NULL || out == NULL) return 1;
+
+    srand(1);
+    int failed = 0;
+
+    printf("%-8s %-15s %-12s %10s %10s %8s\n", "kernel", "variant", "input", UNIT, "MB/s", "check");
+
+    for (int in = 0; in < 4; in++) {
+        if (in == 0) for (size_t i = 0; i < INPUT_SIZE; i++) input[i] = rand();
+        if (in == 1) memset(input, FLAG, INPUT_SIZE);
+        if (in == 2) fillText(input, INPUT_SIZE);
+        if (in == 3 && fillFile(input, INPUT_SIZE, path) == -1) {
+            printf("\n[Warning] Unable to read '%s', skipping it\n", path);
+            break;
+        }
+
+        size_t stuffedSize = stuffSwitch(input, INPUT_SIZE, stuffed);
+        uint64_t reference = 0;
+        printf("\n");
+
+        for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+            const Variant *k = &variants[v];
+            const unsigned char *data = k->stuffedInput ? stuffed : input;
+            size_t n = k->stuffedInput ? stuffedSize : INPUT_SIZE;
+            unsigned long long bestCycles = ~0ULL, bestNs = ~0ULL;
+            size_t produced = 0;
+
+            for (int r = 0; r < WARMUP + REPETITIONS; r++) {
+                unsigned long long ns = nowNs(), cycles = CYCLES();
+                produced = k->run(data, n, out);
+                cycles = CYCLES() - cycles;
+                ns = nowNs() - ns;
+
+                if (r >= WARMUP && cycles < bestCycles) bestCycles = cycles;
+                if (r >= WARMUP && ns < bestNs) bestNs = ns;
+            }
+
+            // the output of every variant must match the reference
+            uint64_t check = digest(out, produced);
+            if (v == 0 || strcmp(k->kernel, variants[v - 1].kernel) != 0) reference = check;
+            int ok = check == reference;
+
+            // destuffing and parsing must give the input back
+            if (k->stuffedInput && (produced != INPUT_SIZE || memcmp(out, input, INPUT_SIZE) != 0)) ok = 0;
+            if (!ok) failed = 1;
+
+            printf("%-8s %-15s %-12s %10.3f %10.1f %8s\n", k->kernel, k->variant, inputs[in],
+                   (double) bestCycles / INPUT_SIZE, INPUT_SIZE / (bestNs / 1e3), ok ? "ok" : "MISMATCH");
+        }
+    }
+
+    printf("\nTimes are per payload byte (%d-byte payloads, best of %d runs).\n", MAX_PAYLOAD_SIZE, REPETITIONS);
+
+    free(input);
+    free(stuffed);
+    free(out);
+    return failed;
+}
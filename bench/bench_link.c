@@ -0,0 +1,484 @@
+// End-to-end link benchmark.
+// Runs a transmitter and a receiver as child processes and times whole file
+// transfers between them. For a point without baud rate, BER or delay, the
+// two talk over a transport pair. Otherwise this process sits in the middle
+// and emulates a serial line between them, as cable does. Frame errors, and
+// with --delay-mode=link the delay too, are injected by the receiver's link
+// layer from a fixed seed, so every point of a sweep can be repeated. Each
+// point prints goodput, efficiency, retransmissions and CPU time, as CSV or
+// JSON Lines.
+
+#define _GNU_SOURCE // ppoll
+
+#include "application_layer.h"
+#include "link_layer.h"
+#include "statistics.h"
+#include "transport.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_POINTS 16
+#define RELAY_QUEUE (1 << 22)
+#define SPARSE_DATA 65536 // random bytes at each end of a sparse file
+
+extern Statistics statistics;
+
+typedef struct {
+    double values[MAX_POINTS];
+    int n;
+} List;
+
+typedef struct {
+    List sizes, bauds, bers, fers, delays; // fers in %, delays in ms
+    unsigned long long seed;               // seed of the link layer faults
+    int linkDelay;                         // delays injected by the link layer, not the line
+    const char *transport;
+    const char *format;
+    int header;
+    int tries;
+    int timeout;
+    int deadline; // seconds before a point is abandoned
+    int sparse;   // files are holes between random ends
+} Options;
+
+typedef struct {
+    int ok;
+    double seconds;
+    Statistics tx, rx;
+    double txCpu, rxCpu;
+} Outcome;
+
+// One direction of the emulated line
+typedef struct {
+    int in, out;
+    unsigned char *bytes;
+    double *due; // when each queued byte reaches the far end
+    size_t head, count;
+    double lineFree; // when the line finishes sending the last byte
+} Direction;
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t nextRandom()
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static double uniform()
+{
+    return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double nowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parseList(const char *text, List *list)
+{
+    list->n = 0;
+
+    while (*text != '\0' && list->n < MAX_POINTS) {
+        char *end;
+        list->values[list->n++] = strtod(text, &end);
+        if (end == text || (*end != ',' && *end != '\0')) return -1;
+        text = *end == ',' ? end + 1 : end;
+    }
+
+    return *text == '\0' ? 1 : -1;
+}
+
+static void writeRandom(FILE *file, long long size)
+{
+    unsigned char block[4096];
+    for (long long pos = 0; pos < size; pos += sizeof(block)) {
+        for (size_t i = 0; i < sizeof(block); i += 8) {
+            uint64_t r = nextRandom();
+            memcpy(block + i, &r, 8);
+        }
+        fwrite(block, 1, size - pos < (long long) sizeof(block) ? size - pos : (long long) sizeof(block), file);
+    }
+}
+
+// A sparse file is only random in its first and last SPARSE_DATA bytes, with
+// a hole in between, so even a file of several GiB is created at once
+static int writeRandomFile(const char *path, long long size, int sparse)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return -1;
+
+    if (sparse && size > 2 * SPARSE_DATA) {
+        writeRandom(file, SPARSE_DATA);
+        fseeko(file, size - SPARSE_DATA, SEEK_SET);
+        writeRandom(file, SPARSE_DATA);
+    } else {
+        writeRandom(file, size);
+    }
+
+    return fclose(file) == 0 ? 1 : -1;
+}
+
+static int sameFiles(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    int same = fa != NULL && fb != NULL;
+
+    unsigned char ba[4096], bb[4096];
+    while (same) {
+        size_t na = fread(ba, 1, sizeof(ba), fa), nb = fread(bb, 1, sizeof(bb), fb);
+        if (na != nb || memcmp(ba, bb, na) != 0) same = 0;
+        if (na == 0) break;
+    }
+
+    if (fa != NULL) fclose(fa);
+    if (fb != NULL) fclose(fb);
+    return same;
+}
+
+/**
+ * @brief Fork a side of the link. The child runs the application layer on
+ * address, with its output discarded, and sends its link statistics back
+ * through statsFd.
+ *
+ * @return pid_t The child, or -1 on error.
+ */
+static pid_t spawn(const Options *opt, const char *address, const char *role, int baud,
+                   const char *file, int statsFd, int closeFd)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    // the relay ignores SIGPIPE, the sides get it as under main
+    signal(SIGPIPE, SIG_DFL);
+    if (closeFd != -1) close(closeFd);
+    if (freopen("/dev/null", "w", stdout) == NULL) _exit(1);
+
+    applicationLayer(address, role, baud, opt->tries, opt->timeout, file);
+
+    if (write(statsFd, &statistics, sizeof(statistics)) != sizeof(statistics)) _exit(1);
+    _exit(0);
+}
+
+/**
+ * @brief Queue the bytes waiting on one direction of the emulated line. Each
+ * byte takes 10 bit times on the line (none when baud is 0), arrives delay
+ * seconds after it is sent, and has one bit flipped with the byte error rate
+ * that matches ber, as in cable.
+ *
+ * @return int 1 if bytes were read, 0 once the sender has closed, -1 on error.
+ */
+static int relayRead(Direction *d, int baud, double byteErrorRate, double delay)
+{
+    unsigned char buffer[4096];
+    size_t room = RELAY_QUEUE - d->count;
+    int n = read(d->in, buffer, room < sizeof(buffer) ? room : sizeof(buffer));
+    if (n <= 0) return n < 0 && errno == EINTR ? 1 : n;
+
+    double now = nowSeconds();
+    double byteTime = baud > 0 ? 10.0 / baud : 0;
+
+    for (int i = 0; i < n; i++) {
+        size_t tail = (d->head + d->count++) % RELAY_QUEUE;
+        unsigned char byte = buffer[i];
+
+        if (byteErrorRate > 0 && uniform() < byteErrorRate) byte ^= 1 << (nextRandom() % 8);
+
+        d->lineFree = (d->lineFree > now ? d->lineFree : now) + byteTime;
+        d->bytes[tail] = byte;
+        d->due[tail] = d->lineFree + delay;
+    }
+
+    return 1;
+}
+
+// Deliver every queued byte that is due, returning when the next one is
+static double relayDeliver(Direction *d, double now)
+{
+    unsigned char buffer[4096];
+    size_t n = 0;
+
+    while (d->count > 0 && d->due[d->head] <= now && n < sizeof(buffer)) {
+        buffer[n++] = d->bytes[d->head];
+        d->head = (d->head + 1) % RELAY_QUEUE;
+        d->count--;
+    }
+
+    for (size_t written = 0; written < n;) {
+        int w = write(d->out, buffer + written, n - written);
+        if (w < 0) return -1;
+        written += w;
+    }
+
+    return d->count > 0 ? d->due[d->head] : -1;
+}
+
+// Wait for a child without blocking, keeping its CPU time
+static int reap(pid_t *pid, double *cpu)
+{
+    struct rusage usage;
+    if (*pid == -1 || wait4(*pid, NULL, WNOHANG, &usage) <= 0) return *pid == -1;
+
+    *cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    *pid = -1;
+    return 1;
+}
+
+// Whether a point needs the emulated line rather than a transport pair
+static int emulatedPoint(const Options *opt, int baud, double ber, double delayMs)
+{
+    return baud > 0 || ber > 0 || (delayMs > 0 && !opt->linkDelay);
+}
+
+static void runPoint(const Options *opt, long long size, int baud, double ber, double fer, double delayMs, Outcome *out)
+{
+    char txFile[] = "/tmp/bench_link_XXXXXX";
+    int tmp = mkstemp(txFile);
+    if (tmp == -1) return;
+    close(tmp);
+
+    char rxFile[sizeof(txFile) + 4];
+    snprintf(rxFile, sizeof(rxFile), "%s.out", txFile);
+    memset(out, 0, sizeof(*out));
+    if (writeRandomFile(txFile, size, opt->sparse) == -1) return;
+
+    int txStats[2], rxStats[2];
+    if (pipe(txStats) == -1 || pipe(rxStats) == -1) return;
+
+    // both children inherit the faults, the transmitter to report the optimum
+    char value[32];
+    snprintf(value, sizeof(value), "%g", fer);
+    setenv("LL_BCC2_ERROR", value, 1);
+    snprintf(value, sizeof(value), "%g", opt->linkDelay ? delayMs : 0);
+    setenv("LL_TPROPAGATION", value, 1);
+    snprintf(value, sizeof(value), "%llu", opt->seed);
+    setenv("LL_SEED", value, 1);
+    double lineDelayMs = opt->linkDelay ? 0 : delayMs;
+
+    int emulated = emulatedPoint(opt, baud, ber, delayMs);
+    int txLink[2] = {-1, -1}, rxLink[2] = {-1, -1};
+    char txAddress[32], rxAddress[32];
+
+    if (emulated) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, txLink) == -1 || socketpair(AF_UNIX, SOCK_STREAM, 0, rxLink) == -1) return;
+        snprintf(txAddress, sizeof(txAddress), "fd:%d", txLink[0]);
+        snprintf(rxAddress, sizeof(rxAddress), "fd:%d", rxLink[0]);
+    } else {
+        if (transportPair(opt->transport) == -1) return;
+        snprintf(txAddress, sizeof(txAddress), "%s:0", opt->transport);
+        snprintf(rxAddress, sizeof(rxAddress), "%s:1", opt->transport);
+    }
+
+    double start = nowSeconds();
+    pid_t rx = spawn(opt, rxAddress, "rx", baud, rxFile, rxStats[1], txLink[0]);
+    pid_t tx = spawn(opt, txAddress, "tx", baud, txFile, txStats[1], rxLink[0]);
+
+    // a side that dies leaves its stats pipe empty and closed, not blocking
+    close(txStats[1]);
+    close(rxStats[1]);
+
+    // drop this process's copy of the link ends, now held by the children
+    if (emulated) {
+        close(txLink[0]);
+        close(rxLink[0]);
+    } else {
+        const Transport *transport = transportFor(txAddress);
+        if (transport->open(txAddress, baud) >= 0) transport->close();
+    }
+
+    Direction dirs[2] = {{.in = txLink[1], .out = rxLink[1]}, {.in = rxLink[1], .out = txLink[1]}};
+    for (int i = 0; i < 2 && emulated; i++) {
+        dirs[i].bytes = malloc(RELAY_QUEUE);
+        dirs[i].due = malloc(RELAY_QUEUE * sizeof(double));
+        if (dirs[i].bytes == NULL || dirs[i].due == NULL) emulated = 0;
+    }
+
+    double byteErrorRate = 1.0;
+    for (int i = 0; i < 8; i++) byteErrorRate *= 1.0 - ber;
+    byteErrorRate = 1.0 - byteErrorRate;
+    int reading[2] = {1, 1};
+
+    while (TRUE) {
+        int txDone = reap(&tx, &out->txCpu);
+        int rxDone = reap(&rx, &out->rxCpu);
+        if (txDone && rxDone) break;
+
+        double now = nowSeconds();
+        if (now - start > opt->deadline) {
+            if (tx != -1) kill(tx, SIGKILL);
+            if (rx != -1) kill(rx, SIGKILL);
+            continue;
+        }
+
+        if (!emulated) {
+            usleep(1000);
+            continue;
+        }
+
+        // sleep until a byte is due, a byte arrives or 10 ms pass
+        double wake = now + 0.01;
+        struct pollfd fds[2];
+        for (int i = 0; i < 2; i++) {
+            double due = relayDeliver(&dirs[i], now);
+            if (due >= 0 && due < wake) wake = due;
+            fds[i].fd = reading[i] && dirs[i].count < RELAY_QUEUE ? dirs[i].in : -1;
+            fds[i].events = POLLIN;
+        }
+
+        struct timespec timeout = {0, wake > now ? (long) ((wake - now) * 1e9) : 0};
+        if (ppoll(fds, 2, &timeout, NULL) <= 0) continue;
+
+        for (int i = 0; i < 2; i++) {
+            if (fds[i].revents != 0 && relayRead(&dirs[i], baud, byteErrorRate, lineDelayMs / 1000.0) == 0) reading[i] = 0;
+        }
+    }
+
+    out->seconds = nowSeconds() - start;
+    out->ok = read(txStats[0], &out->tx, sizeof(out->tx)) == sizeof(out->tx) &&
+              read(rxStats[0], &out->rx, sizeof(out->rx)) == sizeof(out->rx) &&
+              sameFiles(txFile, rxFile);
+
+    for (int i = 0; i < 2; i++) {
+        free(dirs[i].bytes);
+        free(dirs[i].due);
+    }
+    if (txLink[1] != -1) close(txLink[1]);
+    if (rxLink[1] != -1) close(rxLink[1]);
+    close(txStats[0]);
+    close(rxStats[0]);
+    remove(txFile);
+    remove(rxFile);
+}
+
+/**
+ * @brief Best efficiency stop-and-wait can reach on the emulated line, from
+ * the same formula as optimal_efficiency() but with the point's BER, injected
+ * frame error rate and delay: S = (1 - FER) / (1 + 2a).
+ */
+static double pointOptimalEfficiency(int baud, double ber, double fer, double delayMs)
+{
+    double frameBits = MAX_PAYLOAD_SIZE * 8.0;
+    double delivered = 1.0 - fer / 100.0; // 1 - FER
+    for (int i = 0; i < MAX_PAYLOAD_SIZE * 8; i++) delivered *= 1.0 - ber;
+
+    double a = (delayMs / 1000.0) / (frameBits / baud);
+    return delivered / (1 + 2 * a);
+}
+
+static void report(const Options *opt, long long size, int baud, double ber, double fer, double delayMs,
+                   const Outcome *out)
+{
+    double goodput = out->ok ? size * 8.0 / out->seconds : 0;
+    double efficiency = baud > 0 ? goodput / baud : -1;
+    double optimal = baud > 0 ? pointOptimalEfficiency(baud, ber, fer, delayMs) : -1;
+    const char *transport = emulatedPoint(opt, baud, ber, delayMs) ? "emulated" : opt->transport;
+
+    if (strcmp(opt->format, "json") == 0) {
+        printf("{\"payload\": %d, \"size\": %lld, \"transport\": \"%s\", \"baud\": %d, \"ber\": %g, "
+               "\"fer\": %g, \"delay_ms\": %g, \"ok\": %s, \"seconds\": %.6f, \"goodput_bps\": %.0f, ",
+               MAX_PAYLOAD_SIZE, size, transport, baud, ber, fer, delayMs, out->ok ? "true" : "false",
+               out->seconds, goodput);
+        if (baud > 0) printf("\"efficiency\": %.4f, \"optimal\": %.4f, ", efficiency, optimal);
+        else printf("\"efficiency\": null, \"optimal\": null, ");
+        printf("\"frames\": %llu, \"retransmissions\": %llu, \"rx_error_frames\": %llu, "
+               "\"tx_cpu_s\": %.4f, \"rx_cpu_s\": %.4f}\n",
+               (unsigned long long) out->tx.nFrames, (unsigned long long) out->tx.retransmissions,
+               (unsigned long long) out->rx.errorFrames, out->txCpu, out->rxCpu);
+        return;
+    }
+
+    printf("%d,%lld,%s,%d,%g,%g,%g,%d,%.6f,%.0f,", MAX_PAYLOAD_SIZE, size, transport, baud, ber, fer, delayMs,
+           out->ok, out->seconds, goodput);
+    if (baud > 0) printf("%.4f,%.4f,", efficiency, optimal);
+    else printf(",,");
+    printf("%llu,%llu,%llu,%.4f,%.4f\n", (unsigned long long) out->tx.nFrames,
+           (unsigned long long) out->tx.retransmissions, (unsigned long long) out->rx.errorFrames,
+           out->txCpu, out->rxCpu);
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [--sizes=B,...] [--bauds=N,...] [--bers=P,...] [--fers=%%,...] [--delays=MS,...]\n"
+           "       [--delay-mode=line|link] [--seed=N] [--transport=shm|socket|pty]\n"
+           "       [--format=csv|json] [--no-header] [--tries=N] [--timeout=S] [--deadline=S] [--sparse]\n"
+           "A baud rate of 0 leaves the line unpaced. --fers injects that percentage of\n"
+           "BCC2 errors at the receiver. --sparse sends files that are holes between\n"
+           "random ends.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    // a write to a side that has exited fails instead of killing the relay
+    signal(SIGPIPE, SIG_IGN);
+
+    Options opt = {.seed = 1, .transport = "shm", .format = "csv", .header = 1, .tries = 3, .timeout = 1, .deadline = 120};
+    parseList("65536", &opt.sizes);
+    parseList("0,115200", &opt.bauds);
+    parseList("0,0.00001", &opt.bers);
+    parseList("0", &opt.fers);
+    parseList("0,10", &opt.delays);
+
+    for (int i = 1; i < argc; i++) {
+        int result = 1;
+        if (strncmp(argv[i], "--sizes=", 8) == 0) result = parseList(argv[i] + 8, &opt.sizes);
+        else if (strncmp(argv[i], "--bauds=", 8) == 0) result = parseList(argv[i] + 8, &opt.bauds);
+        else if (strncmp(argv[i], "--bers=", 7) == 0) result = parseList(argv[i] + 7, &opt.bers);
+        else if (strncmp(argv[i], "--fers=", 7) == 0) result = parseList(argv[i] + 7, &opt.fers);
+        else if (strncmp(argv[i], "--delays=", 9) == 0) result = parseList(argv[i] + 9, &opt.delays);
+        else if (strcmp(argv[i], "--delay-mode=line") == 0) opt.linkDelay = 0;
+        else if (strcmp(argv[i], "--delay-mode=link") == 0) opt.linkDelay = 1;
+        else if (strncmp(argv[i], "--seed=", 7) == 0) opt.seed = strtoull(argv[i] + 7, NULL, 0);
+        else if (strncmp(argv[i], "--transport=", 12) == 0) opt.transport = argv[i] + 12;
+        else if (strncmp(argv[i], "--format=", 9) == 0) opt.format = argv[i] + 9;
+        else if (strcmp(argv[i], "--no-header") == 0) opt.header = 0;
+        else if (strncmp(argv[i], "--tries=", 8) == 0) opt.tries = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--timeout=", 10) == 0) opt.timeout = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--deadline=", 11) == 0) opt.deadline = atoi(argv[i] + 11);
+        else if (strcmp(argv[i], "--sparse") == 0) opt.sparse = 1;
+        else result = -1;
+
+        if (result == -1) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (opt.header && strcmp(opt.format, "csv") == 0) {
+        printf("payload,size,transport,baud,ber,fer,delay_ms,ok,seconds,goodput_bps,efficiency,optimal,"
+               "frames,retransmissions,rx_error_frames,tx_cpu_s,rx_cpu_s\n");
+    }
+
+    int failed = 0;
+    for (int s = 0; s < opt.sizes.n; s++)
+        for (int b = 0; b < opt.bauds.n; b++)
+            for (int e = 0; e < opt.bers.n; e++)
+                for (int f = 0; f < opt.fers.n; f++)
+                    for (int d = 0; d < opt.delays.n; d++) {
+                        Outcome out;
+                        runPoint(&opt, (long long) opt.sizes.values[s], (int) opt.bauds.values[b],
+                                 opt.bers.values[e], opt.fers.values[f], opt.delays.values[d], &out);
+                        report(&opt, (long long) opt.sizes.values[s], (int) opt.bauds.values[b],
+                               opt.bers.values[e], opt.fers.values[f], opt.delays.values[d], &out);
+                        fflush(stdout);
+                        if (!out.ok) failed = 1;
+                    }
+
+    return failed;
+}
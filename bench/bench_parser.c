@@ -0,0 +1,333 @@
+// Frame parser benchmark.
+// Parses the same stream of stuffed frames with the table-driven parser and
+// with the byte-at-a-time switch parsers it replaced, and reports bytes per
+// cycle for each. The legacy parsers read every byte through a function call,
+// as they did with readByteSerialPort, but from memory, so only parsing is
+// measured and not the system calls.
+
+#include "frame_parser.h"
+#include "link_layer.h"
+#include "protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#define UNIT "bytes/cycle"
+#else
+#define CYCLES() nowNs()
+#define UNIT "bytes/ns"
+
+static unsigned long long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#define N_FRAMES 20000
+#define REPETITIONS 5
+#define CAPACITY (MAX_PAYLOAD_SIZE + 20)
+
+typedef struct {
+    unsigned long frames;
+    unsigned long bytes;    // information field bytes with a good BCC2
+    unsigned char checksum; // XOR of those bytes
+} Result;
+
+static const unsigned char *stream;
+static size_t streamSize;
+static size_t streamPos;
+
+// Stand-in for readByteSerialPort
+__attribute__((noinline)) static int readByte(unsigned char *byte)
+{
+    if (streamPos == streamSize) return -1;
+    *byte = stream[streamPos++];
+    return 1;
+}
+
+// Append a stuffed frame to out, returning its size
+static size_t putFrame(unsigned char *out, unsigned char A, unsigned char C, const unsigned char *data, int size)
+{
+    size_t pos = 0;
+    unsigned char BCC2 = 0;
+
+    out[pos++] = FLAG;
+    out[pos++] = A;
+    out[pos++] = C;
+    out[pos++] = A ^ C;
+
+    for (int i = 0; i <= size && size > 0; i++) {
+        unsigned char byte = i < size ? data[i] : BCC2;
+        if (i < size) BCC2 ^= byte;
+
+        if (byte == FLAG || byte == ESC) {
+            out[pos++] = ESC;
+            out[pos++] = byte ^ 0x20;
+        }
+        else out[pos++] = byte;
+    }
+
+    out[pos++] = FLAG;
+    return pos;
+}
+
+//////////////////////////////////////////////
+// Legacy parsers (from llread and llwrite)
+//////////////////////////////////////////////
+
+typedef enum {
+    START_STATE,
+    FLAG_RCV,
+    A_RCV,
+    C_RCV,
+    BCC_OK,
+    STOP_STATE,
+    DATA_STATE
+} LinkLayerState;
+
+static int destuffing(unsigned char *buf, int bufSize, int *newSize, unsigned char *BCC2)
+{
+    if (buf == NULL || newSize == NULL) return -1;
+    if (bufSize < 1) return 1;
+
+    unsigned char *r = buf, *w = buf;
+
+    while (r < buf + bufSize) {
+        if (*r != ESC) *w++ = *r++;
+        else {
+            if (*(r + 1) == SUF_FLAG) *w++ = FLAG;
+            else if (*(r + 1) == SUF_ESC) *w++ = ESC;
+            r += 2;
+        }
+    }
+
+    *BCC2 = *(w - 1);
+    *newSize = w - buf - 1;
+
+    return 1;
+}
+
+// llread's state machine, one call per I-frame
+static int legacyRead(unsigned char *packet)
+{
+    unsigned char byte_C = 0;
+    int pos = 0;
+    LinkLayerState state = START_STATE;
+
+    while (state != STOP_STATE) {
+        unsigned char byte = 0;
+        if (readByte(&byte) < 0) return -1;
+
+        switch (state) {
+            case START_STATE:
+                pos = 0;
+                byte_C = 0;
+                if (byte == FLAG) state = FLAG_RCV;
+                break;
+
+            case FLAG_RCV:
+                if (byte == A_T) state = A_RCV;
+                else if (byte != FLAG) state = START_STATE;
+                break;
+
+            case A_RCV:
+                if (byte == C_INF(0) || byte == C_INF(1)) {
+                    state = C_RCV;
+                    byte_C = byte;
+                }
+                else if (byte == FLAG) state = FLAG_RCV;
+                else state = START_STATE;
+                break;
+
+            case C_RCV:
+                if ((A_T ^ byte_C) == byte) state = DATA_STATE;
+                else if (byte == FLAG) state = FLAG_RCV;
+                else state = START_STATE;
+                break;
+
+            case DATA_STATE:
+                if (byte == FLAG) {
+                    int newSize = 0;
+                    unsigned char BCC2 = 0;
+                    destuffing(packet, pos, &newSize, &BCC2);
+
+                    unsigned char xor = packet[0];
+                    for (int i = 1; i < newSize; i++) xor ^= packet[i];
+
+                    return xor == BCC2 ? newSize : 0;
+                }
+                packet[pos++] = byte;
+                break;
+
+            default:
+                state = START_STATE;
+        }
+    }
+
+    return -1;
+}
+
+// llwrite's state machine, one call per RR/REJ frame
+static int legacyResponse(unsigned char *C)
+{
+    unsigned char byte_C = 0, byte_A = 0;
+    LinkLayerState state = START_STATE;
+
+    while (state != STOP_STATE) {
+        unsigned char byte = 0;
+        if (readByte(&byte) < 0) return -1;
+
+        switch (state) {
+            case START_STATE:
+                if (byte == FLAG) state = FLAG_RCV;
+                break;
+
+            case FLAG_RCV:
+                if (byte == A_R || byte == A_T) {
+                    state = A_RCV;
+                    byte_A = byte;
+                }
+                else if (byte != FLAG) state = START_STATE;
+                break;
+
+            case A_RCV:
+                if (byte == C_RR(0) || byte == C_RR(1) || byte == C_REJ(0) || byte == C_REJ(1)) {
+                    state = C_RCV;
+                    byte_C = byte;
+                }
+                else if (byte == FLAG) state = FLAG_RCV;
+                else state = START_STATE;
+                break;
+
+            case C_RCV:
+                if (byte == FLAG) state = FLAG_RCV;
+                else if ((byte_A ^ byte_C) == byte) state = BCC_OK;
+                else state = START_STATE;
+                break;
+
+            case BCC_OK:
+                if (byte == FLAG) state = STOP_STATE;
+                else state = START_STATE;
+                break;
+
+            default:
+                state = START_STATE;
+        }
+    }
+
+    *C = byte_C;
+    return 1;
+}
+
+static Result runLegacy(int information)
+{
+    static unsigned char packet[2 * CAPACITY];
+    Result result = {0, 0, 0};
+    streamPos = 0;
+
+    while (TRUE) {
+        if (information) {
+            int size = legacyRead(packet);
+            if (size < 0) break;
+            result.frames++;
+            result.bytes += size;
+            for (int i = 0; i < size; i++) result.checksum ^= packet[i];
+        } else {
+            unsigned char C;
+            if (legacyResponse(&C) < 0) break;
+            result.frames++;
+            result.checksum ^= C;
+        }
+    }
+
+    return result;
+}
+
+static Result runParser(int information)
+{
+    static unsigned char buffer[CAPACITY];
+    Result result = {0, 0, 0};
+    FrameParser parser;
+    parserInit(&parser, buffer, sizeof(buffer));
+
+    // fed in serial port sized chunks
+    for (size_t pos = 0; pos < streamSize;) {
+        size_t n = streamSize - pos < 4096 ? streamSize - pos : 4096;
+        Frame frame;
+        int consumed = 0;
+
+        if (parserFeed(&parser, stream + pos, n, &consumed, &frame)) {
+            result.frames++;
+            if (information && frame.bcc2Ok) {
+                result.bytes += frame.size;
+                for (int i = 0; i < frame.size; i++) result.checksum ^= buffer[i];
+            }
+            if (!information) result.checksum ^= frame.C;
+        }
+        pos += consumed;
+    }
+
+    return result;
+}
+
+static void measure(const char *name, Result (*run)(int), int information, Result *result)
+{
+    double best = 0;
+
+    // first repetition warms caches
+    for (int r = 0; r <= REPETITIONS; r++) {
+        unsigned long long start = CYCLES();
+        *result = run(information);
+        double rate = streamSize / (double) (CYCLES() - start);
+        if (r > 0 && rate > best) best = rate;
+    }
+
+    printf("%-28s %12.3f %12lu\n", name, best, result->frames);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned char *buffer = malloc((size_t) N_FRAMES * (2 * CAPACITY + 8));
+    unsigned char data[MAX_PAYLOAD_SIZE];
+    if (buffer == NULL) return 1;
+
+    srand(1);
+    int failed = FALSE;
+
+    printf("%-28s %12s %12s\n", "parser", UNIT, "frames");
+
+    for (int information = 1; information >= 0; information--) {
+        size_t size = 0;
+
+        for (int i = 0; i < N_FRAMES; i++) {
+            if (information) {
+                for (int j = 0; j < MAX_PAYLOAD_SIZE; j++) data[j] = rand();
+                size += putFrame(buffer + size, A_T, C_INF(i % 2), data, MAX_PAYLOAD_SIZE);
+            }
+            else size += putFrame(buffer + size, A_R, i % 2 ? C_RR(1) : C_REJ(0), NULL, 0);
+        }
+
+        stream = buffer;
+        streamSize = size;
+
+        Result legacy, table;
+        printf("\n%s (%zu bytes)\n", information ? "I-frames" : "supervision frames", size);
+        measure(information ? "switch (llread)" : "switch (llwrite)", runLegacy, information, &legacy);
+        measure("table-driven", runParser, information, &table);
+
+        if (legacy.frames != table.frames || legacy.bytes != table.bytes || legacy.checksum != table.checksum) {
+            printf("MISMATCH: the parsers disagree on this stream\n");
+            failed = TRUE;
+        }
+    }
+
+    free(buffer);
+    return failed;
+}
@@ -5,9 +5,14 @@
 // Modified by: Eduardo Nuno Almeida [enalmeida@fe.up.pt]
 // Modified by: Rui Prior [rcprior@fc.up.pt]
 
+#include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,37 +28,58 @@
 // included by <termios.h>
 #define BAUDRATE B9600         // For struct termios
 #define DEFAULT_BAUDRATE 9600  // For the delaying transmissions
+#define MIN_BAUDRATE 1200
+#define MAX_BAUDRATE 4000000
 #define _POSIX_SOURCE 1        // POSIX compliant source
 #define FALSE 0
 #define TRUE 1
 
 #define BUF_SIZE 2048
 
+// Slots the workers aim to handle per wake-up: one batch covers at least
+// BATCH_NS of line time, and never more than BATCH_MAX slots
+#define BATCH_NS 1000000
+#define BATCH_MAX 65536
+
+// One direction of the cable, moved by its own worker thread. Slot k of the
+// line starts k byte delays after the worker's start on CLOCK_MONOTONIC. A byte
+// read for slot k goes into the ring at k % bufSize and is written out at slot
+// k + bufSize - 1, which sets the propagation delay.
+struct Direction {
+    const char *name;
+    int in;             // emulator end the bytes are read from
+    int out;            // emulator end they are written to
+    int column;         // 0 for Tx->Rx and 1 for Rx->Tx in the log
+    char *ring;
+    char *valid;        // TRUE if corresponding entry holds a byte
+    uint64_t rng;       // state of the noise generator
+    int idle;           // the last batch logged carried no byte
+    pthread_t thread;
+};
+
 // Current running parameters
 struct Parameters {
-    int cableOn;
-    double byteER;   // Byte error rate
+    atomic_int cableOn;
+    _Atomic double byteER;   // Byte error rate
     struct timespec byteDelay;
     unsigned long propDelay;   // Desired propagation delay in usec
     int bufSize;  // Dimensioned to enforce the propagation delay
-    char *tx2rx;
-    char *tx2rxValid;  // TRUE if corresponding entry holds a byte
-    long tx2rxIdx;     // Input index for the tx2rx buffer
-    char *rx2tx;
-    char *rx2txValid;  // TRUE if corresponding entry holds a byte
-    long rx2txIdx;     // Input index for the tx2rx buffer
+    struct Direction dirs[2];
+    atomic_int stopping;     // Set to make the workers return
+    int workersRunning;
     FILE *logfile;
+    int logIdle;             // The last log line marks an idle cable
+    pthread_mutex_t logLock;
 };
 
 struct Parameters par = {
     .cableOn = TRUE,
     .byteER = 0.0,
     .propDelay = 0,
-    .tx2rx = NULL,
-    .tx2rxValid = NULL,
-    .rx2tx = NULL,
-    .rx2txValid = NULL,
-    .logfile = NULL};
+    .dirs = {{.name = "Tx->Rx", .column = 0}, {.name = "Rx->Tx", .column = 1}},
+    .logfile = NULL,
+    .logLock = PTHREAD_MUTEX_INITIALIZER};
+
 
 // Returns: serial port file descriptor (fd).
 int openSerialPort(const char *serialPort, struct termios *oldtio, struct termios *newtio)
@@ -103,18 +129,17 @@ int init_ring_buffers(void)
     }
     long actualPropDelay = bytesInFlight * par.byteDelay.tv_nsec / 1000; // usec
     par.bufSize = bytesInFlight + 1;
-    par.tx2rx = realloc(par.tx2rx, par.bufSize);
-    par.tx2rxValid = realloc(par.tx2rxValid, par.bufSize);
-    par.rx2tx = realloc(par.rx2tx, par.bufSize);
-    par.rx2txValid = realloc(par.rx2txValid, par.bufSize);
-    if (par.tx2rx == NULL || par.tx2rxValid == NULL || par.rx2tx == NULL || par.rx2txValid == NULL)
+    for (int i = 0; i < 2; i++)
     {
-        return -1;
+        struct Direction *d = &par.dirs[i];
+        d->ring = realloc(d->ring, par.bufSize);
+        d->valid = realloc(d->valid, par.bufSize);
+        if (d->ring == NULL || d->valid == NULL)
+        {
+            return -1;
+        }
+        bzero(d->valid, par.bufSize);
     }
-    bzero(par.tx2rxValid, par.bufSize);
-    bzero(par.rx2txValid, par.bufSize);
-    par.tx2rxIdx = 0;
-    par.rx2txIdx = 0;
     printf("PROPAGATION DELAY SET TO %ld usec (DESIRED = %lu usec)\n", actualPropDelay, par.propDelay);
     return 0;
 }
@@ -126,7 +151,7 @@ void set_baud_rate(unsigned long baud)
     // 10 bit times per byte; delay in nanoseconds
     double delay = 1.0e10 / baud;
     par.byteDelay.tv_sec = 0;
-    par.byteDelay.tv_nsec = (long) delay;
+    par.byteDelay.tv_nsec = (long) (delay + 0.5);
     printf("BAUD RATE: %lu\n", baud);
     init_ring_buffers();
 }
@@ -141,79 +166,253 @@ void set_rt_priority(void) {
 }
 
 
-// Compute the difference between two timespecs
-struct timespec timespec_diff(const struct timespec *t2, const struct timespec *t1)
+// Current CLOCK_MONOTONIC time in nanoseconds
+static uint64_t now_ns(void)
 {
-    struct timespec diff = { .tv_sec = t2->tv_sec - t1->tv_sec,
-                             .tv_nsec = t2->tv_nsec - t1->tv_nsec };
-    if (diff.tv_nsec < 0) {
-        diff.tv_nsec += 1000000000;
-        --diff.tv_sec;
-    }
-    return diff;
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
 }
 
 
-// Compute the sum of two timespecs
-struct timespec timespec_sum(const struct timespec *t1, const struct timespec *t2)
+// Sleep until an absolute CLOCK_MONOTONIC time in nanoseconds
+static void sleep_until(uint64_t ns)
 {
-    struct timespec sum = { .tv_sec = t1->tv_sec + t2->tv_sec,
-                             .tv_nsec = t1->tv_nsec + t2->tv_nsec };
-    if (sum.tv_nsec >= 1000000000) {
-        sum.tv_nsec -= 1000000000;
-        ++sum.tv_sec;
-    }
-    return sum;
+    struct timespec t = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) {}
 }
 
 
-// Compare two timespecs returning -1, 0 or 1 if t1 is less than, equal or
-// greater than t2, respectively
-int timespec_comp(const struct timespec *t1, const struct timespec *t2)
+// Noise generator (xorshift64*), one per direction so the workers share nothing
+static double next_random(uint64_t *state)
 {
-    if (t1->tv_sec < t2->tv_sec) {
-        return -1;
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return ((*state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+// Write a whole batch to the far end. A port whose reader stops reading is
+// given a few batches to drain, then the rest of the bytes are lost, as on a
+// line with nobody listening.
+static void write_batch(int fd, const char *buf, size_t length)
+{
+    int tries = 100;
+    while (length > 0 && !atomic_load(&par.stopping))
+    {
+        ssize_t n = write(fd, buf, length);
+        if (n > 0)
+        {
+            buf += n;
+            length -= n;
+        }
+        else if (n == -1 && errno == EAGAIN && tries-- > 0)
+        {
+            struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+            poll(&pfd, 1, BATCH_NS / 1000000);
+        }
+        else if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            break;
+        }
     }
-    else if (t1->tv_sec > t2->tv_sec) {
-        return 1;
+}
+
+
+// Log one slot of a direction, two columns for the byte entering the cable
+// and the byte leaving it, as "XX  YY |" for Tx->Rx and "| XX  YY" for Rx->Tx.
+// Returns the length appended to line.
+static int log_slot(char *line, int column, int in, unsigned char inByte, int out, unsigned char outByte)
+{
+    char inText[3] = "  ", outText[3] = "  ";
+    if (in) sprintf(inText, "%02hhX", inByte);
+    if (out) sprintf(outText, "%02hhX", outByte);
+
+    if (column == 0) return sprintf(line, "%s  %s |\n", inText, outText);
+    return sprintf(line, "       | %s  %s\n", inText, outText);
+}
+
+
+// Worker moving the bytes of one direction. Each wake-up handles the batch
+// of slots that have elapsed since the previous one: it reads at most that
+// many bytes, so the line rate holds, puts them in the last slots of the
+// batch, and writes out every byte whose propagation delay expires within
+// it in a single write. Wake-ups are set against an absolute schedule, so
+// sleeping late never makes the cable drift.
+static void *cable_worker(void *arg)
+{
+    struct Direction *d = arg;
+    const uint64_t byteNs = par.byteDelay.tv_nsec;
+    const int bufSize = par.bufSize;
+    uint64_t step = BATCH_NS / byteNs;
+    if (step < 1) step = 1;
+    if (step > BATCH_MAX) step = BATCH_MAX;
+
+    unsigned char *in = malloc(BATCH_MAX);
+    unsigned char *out = malloc(BATCH_MAX);
+    char *logText = malloc(BATCH_MAX * 20);
+    if (in == NULL || out == NULL || logText == NULL)
+    {
+        perror("Allocating cable batches");
+        exit(-1);
     }
-    else if (t1->tv_nsec < t2->tv_nsec) {
-        return -1;
+    int unreliableRate = FALSE;
+    int idle = FALSE;
+
+    const uint64_t t0 = now_ns();
+    uint64_t slot = 0;
+
+    while (!atomic_load(&par.stopping))
+    {
+        uint64_t now = now_ns();
+        uint64_t due = (now - t0) / byteNs + 1;
+        if ((now - t0) - slot * byteNs >= 1000000000 && unreliableRate == FALSE)
+        {
+            printf("UNRELIABLE RATE: %s could not keep up, more than 1s behind\n"
+                   "No further warnings will be issued\n", d->name);
+            unreliableRate = TRUE;
+        }
+
+        uint64_t n = due - slot;
+        if (n > BATCH_MAX) n = BATCH_MAX;
+
+        ssize_t got = read(d->in, in, n);
+        if (got < 0) got = 0;
+
+        int cableOn = atomic_load(&par.cableOn);
+        double byteER = atomic_load(&par.byteER);
+        int logging = par.logfile != NULL;
+        size_t outLen = 0;
+        size_t logLen = 0;
+
+        for (uint64_t i = 0; i < n; i++, slot++)
+        {
+            // Bytes read in this batch fill its last slots
+            int fresh = i >= n - got && cableOn;
+            unsigned char byte = fresh ? in[i - (n - got)] : 0;
+            d->ring[slot % bufSize] = byte;
+            d->valid[slot % bufSize] = fresh;
+
+            int idx = (slot + 1) % bufSize;
+            int sent = cableOn && d->valid[idx];
+            if (sent)
+            {
+                // At most one wrong bit per byte, good enough if ber < 0.02
+                if (byteER != 0.0 && next_random(&d->rng) < byteER)
+                {
+                    d->ring[idx] ^= (char) 1 << (int) (next_random(&d->rng) * 8);
+                }
+                out[outLen++] = d->ring[idx];
+            }
+
+            if (logging)
+            {
+                if (fresh || sent)
+                {
+                    logLen += log_slot(logText + logLen, d->column, fresh, byte, sent, d->ring[idx]);
+                    idle = FALSE;
+                }
+                else
+                {
+                    idle = TRUE;
+                }
+            }
+        }
+
+        write_batch(d->out, (char *) out, outLen);
+
+        if (logging)
+        {
+            pthread_mutex_lock(&par.logLock);
+            if (par.logfile != NULL)
+            {
+                fwrite(logText, 1, logLen, par.logfile);
+                d->idle = idle;
+                if (logLen > 0) par.logIdle = FALSE;
+                // Mark the first batch where neither direction carries a byte
+                if (par.dirs[0].idle && par.dirs[1].idle && par.logIdle == FALSE)
+                {
+                    fputs("---------------\n", par.logfile);
+                    par.logIdle = TRUE;
+                }
+            }
+            pthread_mutex_unlock(&par.logLock);
+        }
+
+        // The next batch is due once step more slots have started
+        sleep_until(t0 + (slot + step - 1) * byteNs);
     }
-    else if (t1->tv_nsec > t2->tv_nsec) {
-        return 1;
+
+    free(in);
+    free(out);
+    free(logText);
+    return NULL;
+}
+
+
+// Start one worker per direction, from a clean cable
+void start_workers(void)
+{
+    atomic_store(&par.stopping, FALSE);
+    for (int i = 0; i < 2; i++)
+    {
+        struct Direction *d = &par.dirs[i];
+        bzero(d->valid, par.bufSize);
+        d->rng = now_ns() ^ ((uint64_t) i << 32) ^ 0x9E3779B97F4A7C15ULL;
+        if (pthread_create(&d->thread, NULL, cable_worker, d) != 0)
+        {
+            perror("Starting cable worker");
+            exit(-1);
+        }
     }
-    return 0;
+    par.workersRunning = TRUE;
 }
 
 
-int timespec_is_negative(const struct timespec *t)
+// Stop the workers; bytes still in flight are lost
+void stop_workers(void)
 {
-    if (t->tv_sec < 0 || t->tv_nsec < 0)
+    if (!par.workersRunning)
+    {
+        return;
+    }
+    atomic_store(&par.stopping, TRUE);
+    for (int i = 0; i < 2; i++)
     {
-        return TRUE;
+        pthread_join(par.dirs[i].thread, NULL);
     }
-    return FALSE;
+    par.workersRunning = FALSE;
 }
 
 
 void endlog(void)
 {
+    pthread_mutex_lock(&par.logLock);
     if (par.logfile != NULL)
     {
         fclose(par.logfile);
         par.logfile = NULL;
     }
+    pthread_mutex_unlock(&par.logLock);
 }
 
 
 void startlog(const char *filename)
 {
     endlog();
-    par.logfile = fopen(filename, "w");
-    if (par.logfile != NULL)
+    FILE *logfile = fopen(filename, "w");
+    if (logfile != NULL)
     {
-        fprintf(par.logfile, "Tx->Rx | Rx->Tx\n");
+        fprintf(logfile, "Tx->Rx | Rx->Tx\n");
+        pthread_mutex_lock(&par.logLock);
+        par.logfile = logfile;
+        par.logIdle = FALSE;
+        pthread_mutex_unlock(&par.logLock);
         printf("LOGGING TO FILE %s\n", filename);
     }
     else
@@ -235,7 +434,7 @@ void help()
            "--- on           : connect the cable and data is exchanged (default state)\n"
            "--- off          : disconnect the cable disabling data to be exchanged\n"
            "--- ber <ber>    : add noise to data bits at a specified BER (default=0)\n"
-           "--- baud <rate>  : set baud rate, between 1200 and 115200 (default=9600)\n"
+           "--- baud <rate>  : set baud rate, between 1200 and 4000000 (default=9600)\n"
            "                   note that 10 bits are sent per byte (8-N-1)\n"
            "--- prop <delay> : set the propagation delay in usec (0-1000000, default=0)\n"
            "                   will be approximated to an integer multiple of the byte\n"
@@ -285,172 +484,53 @@ int main(int argc, char *argv[])
         exit(-1);
     }
 
-    // Configure stdin to receive commands to this program
-    int oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
-
     char rxStdin[BUF_SIZE] = {0};
 
     int STOP = FALSE;
 
+    par.dirs[0].in = fdTx;
+    par.dirs[0].out = fdRx;
+    par.dirs[1].in = fdRx;
+    par.dirs[1].out = fdTx;
+
     set_baud_rate(DEFAULT_BAUDRATE);
 
+    // Inherited by the workers
     set_rt_priority();
 
-    // For logging
-    char tx2rxTx[3], tx2rxRx[3], rx2txTx[3], rx2txRx[3];
-    int cableIdle = FALSE;
+    start_workers();
 
     printf("\nCable ready\n\n");
 
-    // To compensate for deviations in byte transmission time
-    struct timespec currentTime, nextTxTime, timeDiff, nextWait;
-    int skipWait = FALSE;
-    int unreliableRate = FALSE;
-    clock_gettime(CLOCK_MONOTONIC, &nextTxTime);
-
+    // The workers move the bytes; this thread only waits for commands
     while (STOP == FALSE)
     {
-        // Check how much waiting time we should have (if any)
-        clock_gettime(CLOCK_MONOTONIC, &currentTime);
-        timeDiff = timespec_diff(&currentTime, &nextTxTime);
-        nextTxTime = timespec_sum(&nextTxTime, &par.byteDelay);
-        if (timeDiff.tv_sec >= 1)
-        {
-            if (unreliableRate == FALSE)
-            {
-                printf("UNRELIABLE RATE: Could not keep up, timeDiff exceeded 1s\n"
-                       "No further warnings will be issued\n");
-                unreliableRate = TRUE;
-            }
-        }
-        nextWait = timespec_diff(&nextTxTime, &currentTime);
-        if (timespec_is_negative(&nextWait))
-        {
-            skipWait = TRUE;
-        }
-        else
-        {
-            skipWait = FALSE;
-        }
-
-        // Read from Tx
-        int bytesFromTx = read(fdTx, par.tx2rx + par.tx2rxIdx, 1);
-        par.tx2rxValid[par.tx2rxIdx] = bytesFromTx > 0;
-
-        // Read from Rx
-        int bytesFromRx = read(fdRx, par.rx2tx + par.rx2txIdx, 1);
-        par.rx2txValid[par.rx2txIdx] = bytesFromRx > 0;
-
-        if (!par.cableOn)
-        {
-            // Ignore what was read
-            par.tx2rxValid[par.tx2rxIdx] = 0;
-            par.rx2txValid[par.rx2txIdx] = 0;
-        }
-
-        if (par.logfile != NULL)  // Currently logging
-        {
-            if (par.tx2rxValid[par.tx2rxIdx])
-            {
-                sprintf(tx2rxTx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
-            }
-            else
-            {
-                memcpy(tx2rxTx, "  ", 3);
-            }
-            if (par.rx2txValid[par.rx2txIdx])
-            {
-                sprintf(rx2txTx, "%02hhX", par.rx2tx[par.rx2txIdx]);
-            }
-            else
-            {
-                memcpy(rx2txTx, "  ", 3);
-            }
-        }
-
-        // Advance indices to next position
-        par.tx2rxIdx = (par.tx2rxIdx + 1) % par.bufSize;
-        par.rx2txIdx = (par.rx2txIdx + 1) % par.bufSize;
-
-        if (par.cableOn)
-        {
-            if (par.tx2rxValid[par.tx2rxIdx])
-            {
-                // Add error, if applicable
-                if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
-                {
-                    // At most one wrong bit per byte, good enough if ber < 0.02
-                    par.tx2rx[par.tx2rxIdx] ^= (char) 1 << rand() % 8;
-                }
-                write(fdRx, par.tx2rx + par.tx2rxIdx, 1);
-            }
-
-            if (par.rx2txValid[par.rx2txIdx])
-            {
-                // Add error, if applicable
-                if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
-                {
-                    // At most one wrong bit per byte, good enough if ber < 0.02
-                    par.rx2tx[par.rx2txIdx] ^= (char) 1 << rand() % 8;
-                }
-                write(fdTx, par.rx2tx + par.rx2txIdx, 1);
-            }
-        }
-
-        if (par.logfile != NULL)  // Currently logging
-        {
-            if (par.tx2rxValid[par.tx2rxIdx])
-            {
-                sprintf(tx2rxRx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
-            }
-            else
-            {
-                memcpy(tx2rxRx, "  ", 3);
-            }
-            if (par.rx2txValid[par.rx2txIdx])
-            {
-                sprintf(rx2txRx, "%02hhX", par.rx2tx[par.rx2txIdx]);
-            }
-            else
-            {
-                memcpy(rx2txRx, "  ", 3);
-            }
-
-            if (*tx2rxTx == ' ' && *rx2txTx == ' ' && *tx2rxRx == ' ' && *rx2txRx == ' ')
-            {
-                if (cableIdle == FALSE)
-                {
-                    fputs("---------------\n", par.logfile);
-                    cableIdle = TRUE;
-                }
-            }
-            else
-            {
-                fprintf(par.logfile, "%s  %s | %s  %s\n", tx2rxTx, tx2rxRx, rx2txTx, rx2txRx);
-                cableIdle = FALSE;
-            }
-        }
-
         // Read commands from STDIN to control the cable mode
         int fromStdin = read(STDIN_FILENO, rxStdin, BUF_SIZE);
-        if (fromStdin > 0)
+        if (fromStdin == 0)
+        {
+            // No more commands; keep the cable up until killed
+            pause();
+        }
+        else if (fromStdin > 0)
         {
             rxStdin[fromStdin - 1] = '\0';
 
             if (strcmp(rxStdin, "off") == 0)
             {
                 printf("CONNECTION OFF\n");
+                pthread_mutex_lock(&par.logLock);
                 if (par.cableOn && par.logfile != NULL)
                 {
                     fputs("CABLE OFF\n", par.logfile);
                 }
-                par.cableOn = FALSE;
+                atomic_store(&par.cableOn, FALSE);
+                pthread_mutex_unlock(&par.logLock);
             }
             else if (strcmp(rxStdin, "on") == 0)
             {
                 printf("CONNECTION ON\n");
-                par.cableOn = TRUE;
+                atomic_store(&par.cableOn, TRUE);
             }
             else if (strncmp(rxStdin, "ber ", 4) == 0)
             {
@@ -461,7 +541,7 @@ int main(int argc, char *argv[])
                 acc *= acc;   // Squared
                 acc *= acc;   // To the fourth
                 acc *= acc;   // To the eightth
-                par.byteER = 1.0 - acc;
+                atomic_store(&par.byteER, 1.0 - acc);
                 //printf("Byte Error Rate is %lf\n", par.byteER);
                 if (ber >= 0.0 && ber < 1.0)
                 {
@@ -480,20 +560,15 @@ int main(int argc, char *argv[])
             {
                 unsigned long baud = 0;
                 sscanf(rxStdin + 5, "%lu", &baud);
-                switch (baud) {
-                    case 1200:
-                    case 1800:
-                    case 2400:
-                    case 4800:
-                    case 9600:
-                    case 19200:
-                    case 38400:
-                    case 57600:
-                    case 115200:
-                        set_baud_rate(baud);
-                        break;
-                    default:
-                        printf("UNSUPPORTED BAUD RATE: must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600 or 115200\n");
+                if (baud >= MIN_BAUDRATE && baud <= MAX_BAUDRATE)
+                {
+                    stop_workers();
+                    set_baud_rate(baud);
+                    start_workers();
+                }
+                else
+                {
+                    printf("UNSUPPORTED BAUD RATE: must be between %d and %d\n", MIN_BAUDRATE, MAX_BAUDRATE);
                 }
             }
             else if (strncmp(rxStdin, "prop ", 5) == 0)
@@ -505,8 +580,10 @@ int main(int argc, char *argv[])
                 }
                 else
                 {
+                    stop_workers();
                     par.propDelay = propDelay;
                     init_ring_buffers();
+                    start_workers();
                 }
             }
             else if (strncmp(rxStdin, "log ", 4) == 0)
@@ -521,6 +598,7 @@ int main(int argc, char *argv[])
             else if (strcmp(rxStdin, "quit") == 0)
             {
                 printf("END OF THE PROGRAM\n");
+                stop_workers();
                 STOP = TRUE;
             }
             else if (strcmp(rxStdin, "help") == 0) {
@@ -530,12 +608,10 @@ int main(int argc, char *argv[])
                 printf("BAD COMMAND OR MISSING PARAMETERS\n");
             }
         }
-
-        if (skipWait == FALSE) {
-            nanosleep(&nextWait, NULL);
-        }
     }
 
+    endlog();
+
     // Restore the old port settings
     if (tcsetattr(fdRx, TCSANOW, &oldtioRx) == -1)
     {
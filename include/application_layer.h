@@ -4,6 +4,11 @@
 #ifndef _APPLICATION_LAYER_H_
 #define _APPLICATION_LAYER_H_
 
+// Transfer options
+#define APP_RESUME 0x01 // resume from the receiver's checkpoint
+#define APP_DELTA 0x02  // send only what differs from the receiver's copy
+#define APP_ZERO_RTT 0x04 // send the first START packet inside the SET frame
+
 // Application layer main function.
 // Arguments:
 //   serialPort: Serial port name (e.g., /dev/ttyS0).
@@ -15,4 +20,19 @@
 void applicationLayer(const char *serialPort, const char *role, int baudRate,
                       int nTries, int timeout, const char *filename);
 
+// Batch variant: the transmitter sends every file (directories are expanded
+// to their regular files) back to back in a single link session, each one
+// between its own START and END packets, and closes the batch with a
+// manifest packet. The receiver takes a single file name or a directory,
+// where batch files are written under their announced names.
+// Arguments:
+//   filenames: Names of the files / directories to send, or to receive into.
+//   nFiles: Number of entries in filenames.
+//   options: Bitwise OR of the APP_* transfer options.
+//   maxSuspend: Seconds a silent link may stay suspended before giving up
+//               (0: fail when out of retries, -1: no limit).
+void applicationLayerBatch(const char *serialPort, const char *role, int baudRate,
+                           int nTries, int timeout, const char **filenames, int nFiles,
+                           int options, int maxSuspend);
+
 #endif // _APPLICATION_LAYER_H_
@@ -0,0 +1,55 @@
+// Delta encoding header.
+// rsync-style matching: the receiver describes the file it already has with
+// block signatures (weak rolling checksum + strong hash), and the transmitter
+// rewrites the new file as literal bytes and references to those blocks.
+
+#ifndef _DELTA_H_
+#define _DELTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DELTA_MIN_BLOCK 256
+#define DELTA_MAX_BLOCK 16384
+
+typedef struct {
+    uint32_t weak;
+    uint64_t strong;
+} BlockSignature;
+
+// Called for the next bytes of the new file, up to size of them.
+// Returns the number of bytes read, 0 at the end of the file or -1 on error.
+typedef int (*DeltaRead)(unsigned char *buffer, size_t size);
+
+// Called with each run of literal bytes, in file order.
+// Returns 1 on success or -1 on error.
+typedef int (*DeltaLiteral)(const unsigned char *data, size_t size);
+
+// Called with each run of count consecutive receiver blocks starting at block.
+// Returns 1 on success or -1 on error.
+typedef int (*DeltaCopy)(uint32_t block, uint32_t count);
+
+// Block size used to sign a file of the given size (about its square root).
+size_t deltaBlockSize(size_t fileSize);
+
+// Weak checksum of a block.
+uint32_t deltaWeak(const unsigned char *data, size_t size);
+
+// Slide the weak checksum of a blockSize window one byte forward.
+uint32_t deltaRoll(uint32_t weak, unsigned char out, unsigned char in, size_t blockSize);
+
+// Strong hash of a block.
+uint64_t deltaStrong(const unsigned char *data, size_t size);
+
+#ifndef LL_NO_HEAP
+// Scan the new file, as given by read, with a rolling checksum and emit it
+// as literals and copies of the signed blocks. Only blockSize + literalSize
+// bytes of the file are held at once: literals are emitted at the latest
+// once literalSize of them are pending. Not available with LL_NO_HEAP.
+// Returns 1 on success or -1 on error (including any callback error).
+int deltaEncode(DeltaRead read, size_t literalSize,
+                const BlockSignature *signatures, uint32_t nBlocks, size_t blockSize,
+                DeltaLiteral literal, DeltaCopy copy);
+#endif
+
+#endif // _DELTA_H_
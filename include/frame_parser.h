@@ -0,0 +1,40 @@
+// Frame parser header.
+
+#ifndef _FRAME_PARSER_H_
+#define _FRAME_PARSER_H_
+
+// A received frame. Its destuffed information field is at the start of the
+// parser buffer, followed by BCC2.
+typedef struct {
+    unsigned char A;
+    unsigned char C;
+    int size;   // information field size, -1 for frames without one
+    int bcc2Ok; // whether BCC2 matches the information field
+    int escapes; // escape bytes removed from the field and BCC2
+} Frame;
+
+typedef struct {
+    unsigned char state;
+    unsigned char A;
+    unsigned char C;
+    unsigned char xor;     // running XOR of the field, BCC2 included
+    unsigned char *buffer; // destuffed information field and BCC2
+    int capacity;
+    int size;
+    int escapes;
+    unsigned int errors;   // frames dropped (bad BCC1, bad escape, overflow)
+} FrameParser;
+
+// Reset the parser to look for the next FLAG, writing fields into buffer.
+void parserInit(FrameParser *parser, unsigned char *buffer, int capacity);
+
+// Point the parser at another buffer. A frame half parsed into the old buffer
+// is dropped.
+void parserSetBuffer(FrameParser *parser, unsigned char *buffer, int capacity);
+
+// Parse up to n bytes. Parsing stops right after the closing FLAG of a frame,
+// and the number of bytes used is stored in consumed.
+// Returns 1 when a frame was parsed into frame, 0 if more bytes are needed.
+int parserFeed(FrameParser *parser, const unsigned char *bytes, int n, int *consumed, Frame *frame);
+
+#endif // _FRAME_PARSER_H_
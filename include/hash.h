@@ -0,0 +1,26 @@
+// Streaming hash header.
+// 64-bit xxHash (XXH64), computed incrementally over file chunks.
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t acc[4];
+    uint64_t total;
+    unsigned char buffer[32];
+    size_t buffered;
+} HashState;
+
+// Start a new hash.
+void hashInit(HashState *state);
+
+// Add size bytes of data to the hash.
+void hashUpdate(HashState *state, const unsigned char *data, size_t size);
+
+// Hash of every byte added so far (the state can keep being updated).
+uint64_t hashDigest(const HashState *state);
+
+#endif // _HASH_H_
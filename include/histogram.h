@@ -0,0 +1,58 @@
+// Latency histogram header.
+// Log-bucketed (HDR-style) histograms of nanosecond durations: every power of
+// two is split into HISTOGRAM_SUB linear buckets, so any recorded value is
+// known to within 1/HISTOGRAM_SUB (about 6%). Recording is a bucket index
+// computation and a few increments, cheap enough to stay on in production.
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40 // values from 2^40 ns (about 18 minutes) share the last bucket
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+// Current CLOCK_MONOTONIC time in nanoseconds.
+static inline uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Record a duration in nanoseconds.
+static inline void histogramRecord(Histogram *h, uint64_t ns)
+{
+    int index = (int) ns;
+
+    if (ns >= HISTOGRAM_SUB) {
+        int msb = 63 - __builtin_clzll(ns);
+        if (msb >= HISTOGRAM_MAX_BITS) index = HISTOGRAM_BUCKETS - 1;
+        else index = ((msb - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) +
+                     (int) ((ns >> (msb - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB - 1));
+    }
+
+    h->buckets[index]++;
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max) h->max = ns;
+}
+
+// Smallest value that at least fraction p (0 to 1) of the recorded values
+// do not exceed, to the bucket resolution.
+uint64_t histogramPercentile(const Histogram *h, double p);
+
+// Print count, mean, p50, p90, p99 and max in microseconds on one line.
+void histogramPrint(const char *name, const Histogram *h);
+
+#endif // _HISTOGRAM_H_
@@ -17,11 +17,23 @@ typedef struct
     int baudRate;
     int nRetransmissions;
     int timeout;
+    int maxSuspend; // seconds a silent link may stay suspended (0: fail when out of retries, -1: no limit)
+
+    // Faults the receiver simulates (0 keeps the default from statistics.h).
+    // The LL_TPROPAGATION, LL_BCC1_ERROR, LL_BCC2_ERROR and LL_SEED
+    // environment variables take precedence when set.
+    double propagationMs;    // one-way propagation delay in ms
+    double bcc1Error;        // percentage of I-frames dropped as if BCC1 failed
+    double bcc2Error;        // percentage of I-frames rejected as if BCC2 failed
+    unsigned long long seed; // fault generator seed (0: a new one each run)
 } LinkLayer;
 
 // SIZE of maximum acceptable payload.
 // Maximum number of bytes that application layer should send to link layer
+// (both ends must agree on it)
+#ifndef MAX_PAYLOAD_SIZE
 #define MAX_PAYLOAD_SIZE 1000
+#endif
 
 // MISC
 #define FALSE 0
@@ -31,6 +43,13 @@ typedef struct
 // Return "1" on success or "-1" on error.
 int llopen(LinkLayer connectionParameters);
 
+// Open a connection like llopen; on the transmitter, buf (bufSize bytes, up to
+// MAX_PAYLOAD_SIZE + 20) travels inside the SET frame and UA acknowledges it,
+// saving the round trip of a separate first I-frame. The receiver gets it from
+// its first llread.
+// Return "1" on success or "-1" on error.
+int llopenWithData(LinkLayer connectionParameters, const unsigned char *buf, int bufSize);
+
 // Send data in buf with size bufSize.
 // Return number of chars written, or "-1" on error.
 int llwrite(const unsigned char *buf, int bufSize);
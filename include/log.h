@@ -0,0 +1,52 @@
+// Logger header.
+// Messages are formatted by the caller into a ring of fixed-size records
+// and written to stdout by a background thread, so a slow terminal never
+// holds up the link. A record is claimed with a compare-and-swap and handed
+// over with a semaphore post, both safe in a signal handler. Signal handlers
+// must log with logSignal, which only copies preformatted text. When the ring
+// is full, messages are dropped and counted rather than waited for.
+// With LL_NO_HEAP there is no ring and no thread: each message is written
+// to stdout directly.
+
+#ifndef _LOG_H_
+#define _LOG_H_
+
+// Levels, from the most to the least important
+enum {
+    LOG_LEVEL_OFF,
+    LOG_LEVEL_ERROR,   // [ERROR]
+    LOG_LEVEL_WARNING, // [Warning] and [ALERT] about the link as a whole
+    LOG_LEVEL_STATUS,  // [STATUS]
+    LOG_LEVEL_FRAME,   // per-frame messages (rejections, timeouts)
+};
+
+#define LOG_RECORDS 256     // ring size, a power of two
+#define LOG_RECORD_SIZE 256 // longest message, newline included (a peer message fits)
+
+// Messages above this level are skipped before being formatted
+extern int logLevel;
+
+// Log a printf-style message at level.
+#define logMessage(level, ...) \
+    do { \
+        if ((level) <= logLevel) logWrite(__VA_ARGS__); \
+    } while (0)
+
+// Set the level from its name (off, error, warning, status or frame).
+// Returns 1 on success, -1 if the name is unknown.
+int logSetLevel(const char *name);
+
+// Start the writer thread (none with LL_NO_HEAP). Until then, messages are
+// written directly.
+// Returns 1 on success, -1 on error.
+int logStart();
+
+// Wait until every queued message was written.
+void logFlush();
+
+void logWrite(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// Log text followed by value and a newline. Async-signal-safe.
+void logSignal(int level, const char *text, long value);
+
+#endif // _LOG_H_
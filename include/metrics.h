@@ -0,0 +1,62 @@
+// Live metrics header.
+// The link layer keeps counters and gauges in a struct of atomics, updated
+// with relaxed atomic adds and stores only, so the data path never takes a
+// lock. A server thread publishes them in the Prometheus text format on a
+// UNIX domain socket, answering plain connections and HTTP GETs alike, and
+// can rewrite a metrics file every METRICS_FILE_PERIOD_MS:
+//   curl --unix-socket /tmp/ll.sock http://localhost/metrics
+//   socat - UNIX-CONNECT:/tmp/ll.sock
+// With LL_NO_HEAP only the counters are kept: there is no server thread.
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define METRICS_FILE_PERIOD_MS 1000
+
+// Upper bounds of the round trip histogram buckets, in microseconds
+#define METRICS_RTT_BOUNDS_US {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000}
+#define METRICS_RTT_BUCKETS 15 // the bounds above and +Inf
+
+typedef struct {
+    // counters
+    atomic_uint_fast64_t framesSent;       // every frame written, resends included
+    atomic_uint_fast64_t framesResent;
+    atomic_uint_fast64_t framesReceived;   // frames parsed, good or not
+    atomic_uint_fast64_t framesRejected;   // REJ sent (receiver) or received (transmitter)
+    atomic_uint_fast64_t framesDropped;    // dropped by the parser
+    atomic_uint_fast64_t timeouts;
+    atomic_uint_fast64_t payloadBytes;     // bytes by cause, as in Statistics
+    atomic_uint_fast64_t headerBytes;
+    atomic_uint_fast64_t stuffingBytes;
+    atomic_uint_fast64_t retransmittedBytes;
+    atomic_uint_fast64_t supervisionBytes;
+    atomic_uint_fast64_t rttBuckets[METRICS_RTT_BUCKETS]; // I-frames acknowledged after a single send
+    atomic_uint_fast64_t rttSumNs;
+
+    // gauges
+    atomic_int role;                        // LlTx or LlRx
+    atomic_int linkUp;
+    atomic_int suspended;
+    atomic_int window;                      // I-frames sent and not acknowledged yet
+    atomic_uint_fast64_t rtoMs;             // retransmission timeout
+    atomic_uint_fast64_t lastRttNs;
+    atomic_uint_fast64_t throughput;        // live payload rate, bytes per second
+} Metrics;
+
+extern Metrics metrics;
+
+#define metricAdd(field, n) atomic_fetch_add_explicit(&metrics.field, (n), memory_order_relaxed)
+#define metricSet(field, value) atomic_store_explicit(&metrics.field, (value), memory_order_relaxed)
+
+// Record the round trip of an I-frame sent once.
+void metricsRecordRtt(uint64_t ns);
+
+// Serve the metrics on a UNIX socket at socketPath and/or rewrite them into
+// filePath (either may be NULL), from a thread started now.
+// Returns 1 on success, -1 on error.
+int metricsStart(const char *socketPath, const char *filePath);
+
+#endif // _METRICS_H_
@@ -0,0 +1,39 @@
+// Packet pool header.
+
+#ifndef _PACKET_POOL_H_
+#define _PACKET_POOL_H_
+
+#include "link_layer.h"
+#include "protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A slot holds the largest frame: every byte of a full packet and its BCC2
+// stuffed, plus the header and FLAGs. Rounded up to keep slots aligned.
+#define POOL_SLOT_SIZE ((2 * (MAX_PAYLOAD_SIZE + METADATA_SIZE) + 7 + 15) & ~15)
+#ifndef POOL_SLOTS
+#define POOL_SLOTS 8
+#endif
+
+typedef struct {
+    uint64_t hits;   // allocations served from the pool
+    uint64_t misses; // allocations that did not fit (too big or pool empty)
+    int inUse;       // slots handed out now
+    int peak;        // most slots handed out at once
+} PoolStatistics;
+
+extern PoolStatistics poolStatistics;
+
+// Hand out a buffer of at least size bytes, from the pool when it fits and
+// from malloc otherwise. With LL_NO_HEAP there is no fallback.
+// Returns NULL on error.
+void *poolAlloc(size_t size);
+
+// Give back a buffer from poolAlloc (NULL is ignored).
+void poolFree(void *buffer);
+
+// Number of slots free now.
+int poolAvailable();
+
+#endif // _PACKET_POOL_H_
@@ -0,0 +1,54 @@
+// Pseudo-random number generator header.
+// xoshiro256** (Blackman and Vigna): 256 bits of state, a few shifts and
+// rotations per number, and the same sequence on every platform for a given
+// seed, so runs with injected faults can be repeated exactly. The state is
+// filled from the 64-bit seed with splitmix64, which never leaves it all zero.
+
+#ifndef _PRNG_H_
+#define _PRNG_H_
+
+#include <stdint.h>
+
+typedef struct {
+    uint64_t s[4];
+} Prng;
+
+static inline uint64_t prngRotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// Seed the generator. Any seed, 0 included, is valid.
+static inline void prngSeed(Prng *p, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        p->s[i] = z ^ (z >> 31);
+    }
+}
+
+static inline uint64_t prngNext(Prng *p)
+{
+    uint64_t *s = p->s;
+    uint64_t result = prngRotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = prngRotl(s[3], 45);
+
+    return result;
+}
+
+// Uniform double in [0, 1).
+static inline double prngDouble(Prng *p)
+{
+    return (prngNext(p) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#endif // _PRNG_H_
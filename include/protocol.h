@@ -10,6 +10,7 @@
 #define C_SET       0x03
 #define C_UA        0x07
 #define C_DISC      0x0B
+#define C_KEEPALIVE 0x0F
 #define SUF_FLAG    0x5E
 #define SUF_ESC     0x5D
 
@@ -21,9 +22,43 @@
 #define C_START 1
 #define C_DATA 2
 #define C_END 3
+#define C_MSG 4
+#define C_MANIFEST 5
+#define C_RESUME 6
+#define C_SIGNATURE 7
+#define C_COPY 8
+
+// Packet Channel Field
+#define CH_FILE 0
+#define CH_CONTROL 1
+#define N_CHANNELS 2
 
 // Packet Type Field
 #define T_FILESIZE 0
 #define T_FILENAME 1
+#define T_BATCH 2
+#define T_FILECOUNT 3
+#define T_RESUME 4
+#define T_OFFSET 5
+#define T_HASH 6
+#define T_DELTA 7
+#define T_STREAM 8
+
+// Data packet header: C, channel, 32-bit sequence number, 16-bit length
+#define DATA_HEADER_SIZE 8
+
+// Sequence number of the first data packet of a session (both ends must
+// agree). check_large starts just below the wrap to cross it.
+#ifndef FIRST_DATA_SEQUENCE
+#define FIRST_DATA_SEQUENCE 0
+#endif
+
+// File bytes carried by a packet of size bytes: the data of a DATA packet,
+// none for the other packets, which are all header
+#define PACKET_PAYLOAD_SIZE(packet, size) \
+    ((size) > DATA_HEADER_SIZE && (packet)[0] == C_DATA ? (size) - DATA_HEADER_SIZE : 0)
+
+// Room for packet headers on top of MAX_PAYLOAD_SIZE
+#define METADATA_SIZE 20
 
 #endif // _PROTOCOL_H_
@@ -0,0 +1,58 @@
+// Packet scheduler header.
+// Multiplexes several logical channels over the link layer, with a weighted
+// priority scheduler in front of llwrite and per-channel receive demultiplexing.
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include "link_layer.h"
+#include "protocol.h"
+
+// Number of packets that can wait on each channel.
+#define SCHED_QUEUE_SIZE 8
+
+// Largest packet handed to llwrite.
+#define SCHED_PACKET_SIZE (MAX_PAYLOAD_SIZE + METADATA_SIZE)
+
+// Handler called for every packet received on a channel.
+// Returns 1 on success or -1 on error.
+typedef int (*ChannelHandler)(unsigned char *packet, int size);
+
+// Function called before the scheduler picks each packet to send, so what it
+// queues (e.g. an urgent message typed meanwhile) competes for that frame.
+typedef void (*SchedulerPoll)();
+
+// Set the priority (0 is the most urgent) and weight of a channel.
+// Channels with the same priority share the link in proportion to their weight.
+// Returns 1 on success or -1 on error.
+int schedulerSetChannel(unsigned char channel, int priority, int weight);
+
+// Queue a packet from poolAlloc on the channel given by its channel field
+// (packet[1]). Once queued the packet belongs to the scheduler, which gives
+// it back with poolFree after it is sent; otherwise the caller keeps it.
+// Returns 1 on success, 0 if the channel queue is full or -1 on error.
+int schedulerEnqueue(unsigned char *packet, int size);
+
+// Number of packets waiting on a channel.
+int schedulerPending(unsigned char channel);
+
+// Set the function called before each packet is picked (NULL for none).
+void schedulerSetPoll(SchedulerPoll poll);
+
+// Send the next packet chosen by the scheduler with llwrite.
+// Returns the number of bytes written, 0 if nothing is queued or -1 on error.
+int schedulerSendNext();
+
+// Send every queued packet.
+// Returns 1 on success or -1 on error.
+int schedulerFlush();
+
+// Register the receive handler of a channel.
+// Returns 1 on success or -1 on error.
+int schedulerSetHandler(unsigned char channel, ChannelHandler handler);
+
+// Hand a packet returned by llread to the handler of its channel.
+// Returns the handler result, or 0 if the channel is unknown (packet discarded).
+int schedulerDispatch(unsigned char *packet, int size);
+
+#endif // _SCHEDULER_H_
@@ -17,9 +17,15 @@ int closeSerialPort();
 // Returns -1 on error, 0 if no byte was received, 1 if a byte was received.
 int readByteSerialPort(unsigned char *byte);
 
+// Read up to numBytes already received from the serial port (must check how
+// many were actually read from the return value).
+// Returns -1 on error, otherwise the number of bytes read (0 if none).
+int readBytesSerialPort(unsigned char *bytes, int numBytes);
+
 // Write up to numBytes to the serial port (must check how many were actually
 // written in the return value).
-// Returns -1 on error, otherwise the number of bytes written.
+// Returns -1 on error, TRANSPORT_PEER_CLOSED if the peer has closed its end of
+// a socket, otherwise the number of bytes written.
 int writeBytesSerialPort(const unsigned char *bytes, int numBytes);
 
 #endif // _SERIAL_PORT_H_
@@ -0,0 +1,26 @@
+// Serial port speed header.
+// Rates without a B* constant in <termios.h> are set through termios2 and
+// BOTHER, which take the rate as a number. That needs <asm/termbits.h>, whose
+// struct termios clashes with the one in <termios.h>, so it has a translation
+// unit of its own.
+
+#ifndef _SERIAL_SPEED_H_
+#define _SERIAL_SPEED_H_
+
+// Range of baud rates accepted by the program (USB-serial adapters reach 4 Mbaud)
+#define SERIAL_BAUD_MIN 1200
+#define SERIAL_BAUD_MAX 4000000
+
+// A device may only approximate a custom rate; beyond this deviation, in
+// percent, the two ends would no longer understand each other
+#define SERIAL_BAUD_TOLERANCE 2.0
+
+// Returns 1 if baudRate is within [SERIAL_BAUD_MIN, SERIAL_BAUD_MAX], 0 otherwise.
+int serialBaudRateValid(int baudRate);
+
+// Set both speeds of the open tty fd to an arbitrary baudRate.
+// Returns the rate the device actually runs at, or -1 on error (or where
+// termios2 is not available).
+int serialSetCustomSpeed(int fd, int baudRate);
+
+#endif // _SERIAL_SPEED_H_
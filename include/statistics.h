@@ -1,34 +1,89 @@
 #ifndef _STATISTICS_H_
 #define _STATISTICS_H_
 
+#include "histogram.h"
+
 #include <stdio.h>
+#include <stdint.h>
 #include <sys/time.h>
 
+// Default simulated faults, replaced at runtime by the LinkLayer settings and
+// the LL_TPROPAGATION, LL_BCC1_ERROR and LL_BCC2_ERROR environment variables
 #define TPROPAGATION    0  // propagation delay in ms
 #define BCC1_ERROR      0   // percentage % of frames with BCC1 error
 #define BCC2_ERROR      0   // percentage % of frames with BCC2 error
 
-#define FILESIZE        10968
+#define RATE_WINDOW_S   10 // seconds covered by the live rate
+#define RATE_PRINT_S    5  // seconds between live rate lines
+
+// Payload bytes per second over the last RATE_WINDOW_S seconds, kept as one
+// bucket per second
+typedef struct {
+    uint64_t bytes[RATE_WINDOW_S];
+    uint64_t second[RATE_WINDOW_S]; // second each bucket belongs to
+    uint64_t startNs;               // time of the first record
+    uint64_t lastPrint;             // second of the last live rate line
+} RateWindow;
+
+// Faults the receiver simulates on the I-frames it takes
+typedef struct {
+    double propagationMs; // one-way propagation delay
+    double bcc1Error;     // percentage of frames dropped as if BCC1 failed
+    double bcc2Error;     // percentage of frames rejected as if BCC2 failed
+    uint64_t seed;        // seed of the fault generator
+} LinkFaults;
+
+extern LinkFaults faults;
 
 typedef struct {
-    unsigned int bytesRead;
-    unsigned int nFrames;
-    unsigned int errorFrames;
-    unsigned int retransmissions;
+    uint64_t bytesRead;
+    uint64_t nFrames;
+    uint64_t errorFrames;
+    uint64_t retransmissions;
+    uint64_t handshakeProbes; // SET/DISC retries while the backoff is below the timeout
     struct timeval startTime;
     struct timeval endTime;
+    double connectTime;  // seconds from llopen to the established link
+    double closeTime;    // seconds spent in llclose
+
+    // Link bytes by cause. The transmitter counts the I-frames it sends and
+    // the receiver the ones it takes; both count the S and U frames they send
+    // and receive.
+    uint64_t payloadBytes;       // file bytes delivered (acknowledged or taken)
+    uint64_t headerBytes;        // FLAG, A, C, BCC1, BCC2 and FLAG of those I-frames, and their packet headers
+    uint64_t stuffingBytes;      // escape bytes added to those I-frames
+    uint64_t retransmittedBytes; // frames sent again, or I-frame copies that delivered nothing
+    uint64_t supervisionBytes;   // S and U frames (SET, UA, DISC, RR, REJ, keepalives), handshake probes included
+    uint64_t idleNs;             // time spent polling a silent line
+    RateWindow rate;
+
+    Histogram ackTime;    // I-frame first sent to acknowledged (retries included)
+    Histogram encodeTime; // building and stuffing an I-frame
+    Histogram decodeTime; // parsing the bytes of each received frame
+    Histogram ioTime;     // serial port calls that moved bytes
 } Statistics;
 
 double timeDiff(struct timeval start, struct timeval end);
 
 double propagation_to_transmission_ratio(int baudrate, int maxPayload);
 
-double received_bit_rate(Statistics stats);
+// Payload bits per second from the established link to the end of llclose.
+double received_bit_rate(const Statistics *stats);
 
 double fer();
 
 double optimal_efficiency(int baudrate, int maxPayload);
 
-double actual_efficiency(Statistics stats, int baudrate);
+// Payload bit rate over the link capacity.
+double actual_efficiency(const Statistics *stats, int baudrate);
+
+// Bytes of every cause put together.
+uint64_t total_link_bytes(const Statistics *stats);
+
+// Count payload bytes delivered at time nowNs.
+void rateRecord(RateWindow *rate, uint64_t bytes, uint64_t nowNs);
+
+// Payload bytes per second over the last RATE_WINDOW_S seconds before nowNs.
+double rateBytesPerSecond(const RateWindow *rate, uint64_t nowNs);
 
 #endif // _STATISTICS_H_
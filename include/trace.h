@@ -0,0 +1,89 @@
+// Link trace header.
+// A ring of fixed-size binary events in memory: frames sent, resent, received
+// and dropped, timeouts and link state changes, each with a CLOCK_MONOTONIC
+// timestamp and the sequence numbers at that moment. Appends take a slot with
+// one atomic increment, so the alarm handlers can record from signal context.
+// The ring keeps the last TRACE_EVENTS events and is written to a file by
+// llclose, at exit, on SIGUSR1 (a snapshot) and on SIGINT or SIGTERM.
+// While tracing is off, every trace point is a single predicted branch.
+// tools/trace_analyser.c reads the file back.
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+// Ring size, a power of two (16 bytes per event)
+#ifndef TRACE_EVENTS
+#ifdef LL_NO_HEAP
+#define TRACE_EVENTS (1 << 8)
+#else
+#define TRACE_EVENTS (1 << 16)
+#endif
+#endif
+
+#define TRACE_MAGIC "LLTRACE1"
+
+// Event types
+enum {
+    TRACE_SEND = 1, // first send of a frame, or a handshake probe (arg: frame size)
+    TRACE_RESEND,   // frame sent again (arg: frame size)
+    TRACE_RECEIVE,  // frame received (arg: information field size, -1 for S and U frames)
+    TRACE_BAD_BCC2, // I-frame received with a bad BCC2 (arg: information field size)
+    TRACE_DROP,     // frames dropped by the parser (arg: how many)
+    TRACE_TIMEOUT,  // alarm fired (arg: alarm count)
+    TRACE_STATE,    // link state change (arg: one of the states below)
+};
+
+// Link states
+enum {
+    TRACE_OPENING = 1,
+    TRACE_CONNECTED,
+    TRACE_SUSPENDED,
+    TRACE_RESUMED,
+    TRACE_CLOSING,
+    TRACE_CLOSED,
+};
+
+typedef struct {
+    uint64_t ns;  // CLOCK_MONOTONIC time
+    int32_t arg;
+    uint8_t type; // 0 while the slot is being written
+    uint8_t A;
+    uint8_t C;
+    uint8_t seq;  // Ns in bit 0 and Nr in bit 1
+} TraceEvent;
+
+// File layout: this header, then count events, oldest first
+typedef struct {
+    char magic[8];
+    uint32_t eventSize;
+    uint32_t role;     // LlTx or LlRx
+    uint32_t baudRate;
+    uint32_t maxPayload;
+    uint64_t count;
+    uint64_t lost;     // older events overwritten by the ring
+} TraceHeader;
+
+extern int traceEnabled;
+
+// Start tracing into path, installing the flush handlers.
+// Returns 1 on success, -1 on error.
+int traceStart(const char *path);
+
+// Write the ring to the trace file. Async-signal-safe.
+// Returns 1 on success, -1 on error.
+int traceFlush();
+
+// Record the link role, baud rate and payload size for the file header.
+void traceSetLink(int role, int baudRate);
+
+void traceAppend(uint8_t type, uint8_t A, uint8_t C, uint8_t seq, int32_t arg);
+
+// Record an event if tracing is on.
+static inline void traceEvent(uint8_t type, uint8_t A, uint8_t C, uint8_t seq, int32_t arg)
+{
+    if (__builtin_expect(traceEnabled, 0)) traceAppend(type, A, C, seq, arg);
+}
+
+#endif // _TRACE_H_
@@ -0,0 +1,66 @@
+// Transport header.
+// A transport carries the raw bytes of the link. The serial port functions
+// forward to the transport chosen by the address given to openSerialPort:
+//   /dev/ttyS10   a serial port (or any tty)
+//   pty:0, pty:1  the slave and master ends of a pseudo-terminal pair
+//   socket:0/1    the two ends of a UNIX socketpair
+//   shm:0, shm:1  the two ends of a shared-memory ring, with no system calls
+//   fd:N          an inherited file descriptor (a socket, pipe or pty end)
+// The pty, socket and shm ends belong to a pair created by transportPair
+// before the two sides are forked. End 0 is meant for the transmitter and end
+// 1 for the receiver. Only a program that creates the pair and forks both
+// sides, like the benchmark, can use them: main runs one side on its own, so
+// it takes a tty or an fd:N end it inherited.
+// A read that finds no bytes yields the CPU, so the peer runs even on a
+// single core.
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+typedef struct {
+    const char *name;
+
+    // Open the end named by address.
+    // Returns -1 on error.
+    int (*open)(const char *address, int baudRate);
+
+    // Close the end.
+    // Returns -1 on error.
+    int (*close)();
+
+    // Read up to numBytes already received, without waiting.
+    // Returns -1 on error, otherwise the number of bytes read (0 if none).
+    int (*read)(unsigned char *bytes, int numBytes);
+
+    // Write numBytes, waiting for room if needed.
+    // Returns -1 on error, TRANSPORT_PEER_CLOSED once the peer has closed its
+    // end, otherwise the number of bytes written.
+    int (*write)(const unsigned char *bytes, int numBytes);
+} Transport;
+
+// Returned by write when the peer has closed its end of the link
+#define TRANSPORT_PEER_CLOSED -2
+
+extern const Transport ttyTransport;
+extern const Transport ptyTransport;
+extern const Transport socketTransport;
+extern const Transport shmTransport;
+extern const Transport fdTransport;
+
+// Size of each direction of the shared-memory ring.
+#define SHM_RING_SIZE (1 << 20)
+
+// Transport that serves address (the tty one when there is no known prefix).
+const Transport *transportFor(const char *address);
+
+// Make transport serve the addresses that start with its name and a colon,
+// ahead of the built-in ones (e.g. the link simulator's "sim:0" and "sim:1").
+// Returns 1 on success or -1 if there is no room for another transport.
+int transportAdd(const Transport *transport);
+
+// Create both ends of a pty, socket or shm link (kind is "pty", "socket" or
+// "shm"), to be opened as "<kind>:0" and "<kind>:1".
+// Returns 1 on success or -1 on error.
+int transportPair(const char *kind);
+
+#endif // _TRANSPORT_H_
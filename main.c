@@ -6,43 +6,96 @@
 #include <string.h>
 
 #include "application_layer.h"
+#include "trace.h"
+#include "log.h"
+#include "metrics.h"
+#include "serial_speed.h"
 
 #define N_TRIES 3
 #define TIMEOUT 4
+#define MAX_SUSPEND (4 * TIMEOUT * N_TRIES) // seconds, 0: no suspension, -1: no limit
 
 
 // Arguments:
 //   $1: /dev/ttySxx
 //   $2: baud rate
 //   $3: tx | rx
-//   $4: filename
+//   $4: filename ("-" streams from stdin / to stdout)
+//   $5..: more filenames to send in the same session (tx only)
+//   options:
+//     --resume: resume from the receiver's checkpoint (tx only)
+//     --delta: send only what differs from the receiver's copy (tx only)
+//     --0rtt: send the first START packet inside the SET frame (tx only)
+//     --max-suspend=<s>: give up after the link was silent for <s> seconds
+//                        (default 48, 0: fail when out of retries, -1: wait for the line to come back)
+//     --trace=<file>: write a binary trace of the link to <file>
+//     --log-level=<level>: off, error, warning, status or frame (default)
+//     --metrics-socket=<path>: serve live metrics on a UNIX socket at <path>
+//     --metrics-file=<file>: rewrite live metrics into <file> every second
 int main(int argc, char *argv[])
 {
+#ifdef LL_NO_HEAP
+    // an unbuffered stdout never allocates a buffer for printf
+    setvbuf(stdout, NULL, _IONBF, 0);
+#endif
+
     if (argc < 5) {
-        printf("Usage: %s /dev/ttySxx baudrate tx|rx filename\n", argv[0]);
+        printf("Usage: %s /dev/ttySxx baudrate tx|rx filename [filename...] [--resume] [--delta] [--0rtt] [--max-suspend=<s>] [--trace=<file>] [--log-level=<level>]\n"
+               "       [--metrics-socket=<path>] [--metrics-file=<file>]\n", argv[0]);
         exit(1);
     }
 
     const char *serialPort = argv[1];
     const int baudrate = atoi(argv[2]);
     const char *role = argv[3];
-    const char *filename = argv[4];
+
+    // Split filenames and options
+    const char *filenames[argc];
+    int nFiles = 0;
+    int options = 0;
+    int maxSuspend = MAX_SUSPEND;
+    const char *tracePath = NULL;
+    const char *metricsSocket = NULL;
+    const char *metricsFile = NULL;
+
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--resume") == 0) {
+            options |= APP_RESUME;
+        } else if (strcmp(argv[i], "--delta") == 0) {
+            options |= APP_DELTA;
+        } else if (strcmp(argv[i], "--0rtt") == 0) {
+            options |= APP_ZERO_RTT;
+        } else if (strncmp(argv[i], "--max-suspend=", 14) == 0) {
+            maxSuspend = atoi(argv[i] + 14);
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            tracePath = argv[i] + 8;
+        } else if (strncmp(argv[i], "--metrics-socket=", 17) == 0) {
+            metricsSocket = argv[i] + 17;
+        } else if (strncmp(argv[i], "--metrics-file=", 15) == 0) {
+            metricsFile = argv[i] + 15;
+        } else if (strncmp(argv[i], "--log-level=", 12) == 0) {
+            if (logSetLevel(argv[i] + 12) != 1) {
+                printf("ERROR: Unknown log level %s\n", argv[i] + 12);
+                exit(5);
+            }
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            printf("ERROR: Unknown option %s\n", argv[i]);
+            exit(5);
+        } else {
+            filenames[nFiles++] = argv[i];
+        }
+    }
+
+    if (nFiles == 0) {
+        printf("ERROR: Missing filename\n");
+        exit(1);
+    }
+    const char *filename = filenames[0];
 
     // Validate baud rate
-    switch (baudrate) {
-        case 1200:
-        case 1800:
-        case 2400:
-        case 4800:
-        case 9600:
-        case 19200:
-        case 38400:
-        case 57600:
-        case 115200:
-            break;
-        default:
-            printf("Unsupported baud rate (must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600, 115200)\n");
-            exit(2);
+    if (!serialBaudRateValid(baudrate)) {
+        printf("Unsupported baud rate (must be between %d and %d)\n", SERIAL_BAUD_MIN, SERIAL_BAUD_MAX);
+        exit(2);
     }
 
     // Validate role
@@ -51,21 +104,34 @@ int main(int argc, char *argv[])
         exit(3);
     }
 
-    printf("Starting link-layer protocol application\n"
+    // Validate number of files
+    if (strcmp("rx", role) == 0 && nFiles > 1) {
+        printf("ERROR: The receiver takes a single file or directory\n");
+        exit(4);
+    }
+
+    // stdout carries the received data when receiving to "-"
+    FILE *info = strcmp("rx", role) == 0 && strcmp(filename, "-") == 0 ? stderr : stdout;
+
+    fprintf(info, "Starting link-layer protocol application\n"
            "  - Serial port: %s\n"
            "  - Role: %s\n"
            "  - Baudrate: %d\n"
            "  - Number of tries: %d\n"
            "  - Timeout: %d\n"
-           "  - Filename: %s\n",
+           "  - Filename: %s%s\n",
            serialPort,
            role,
            baudrate,
            N_TRIES,
            TIMEOUT,
-           filename);
+           filename,
+           nFiles > 1 ? " (batch)" : "");
+
+    if (tracePath != NULL && traceStart(tracePath) != 1) exit(6);
+    if (metricsStart(metricsSocket, metricsFile) != 1) exit(6);
 
-    applicationLayer(serialPort, role, baudrate, N_TRIES, TIMEOUT, filename);
+    applicationLayerBatch(serialPort, role, baudrate, N_TRIES, TIMEOUT, filenames, nFiles, options, maxSuspend);
 
     return 0;
 }
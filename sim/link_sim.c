@@ -0,0 +1,698 @@
+// Discrete-event link simulator.
+// Runs whole file transfers through the real application and link layers in
+// virtual time. Each point of a sweep forks a transmitter and a receiver that
+// take turns on one core: a side runs until its serial port has nothing to
+// read and its timer isn't due, then the side with the earliest next event
+// runs and the virtual clock jumps to that event. Hours of link time take
+// seconds, and independent points run in parallel, one per core by default.
+//
+// The line between the sides behaves like cable: each byte leaves on the next
+// free byte tick (10 bit times at the baud rate), arrives the propagation
+// delay later rounded to whole byte times (cable's ring buffer), and has one
+// bit flipped with the byte error rate that matches the BER. Frame errors are
+// injected by the receiver's link layer, from a fixed seed.
+//
+// The link layer reads the clock and arms its timer through clock_gettime,
+// gettimeofday, alarm and setitimer. The Makefile links this program with
+// those calls wrapped (-Wl,--wrap), so the virtual clock stands in for them
+// and the code under test is the code that runs on a serial port.
+
+#define _GNU_SOURCE
+
+#include "application_layer.h"
+#include "link_layer.h"
+#include "prng.h"
+#include "protocol.h"
+#include "statistics.h"
+#include "trace.h"
+#include "transport.h"
+
+#include <errno.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_POINTS 16                   // values per parameter list
+#define SIM_QUEUE (1 << 16)             // bytes queued on each direction of the line
+#define SIM_EPOCH_NS 1000000000000ULL   // virtual CLOCK_MONOTONIC when a point starts
+#define NEVER UINT64_MAX
+
+// Exit codes of a side that can't go on
+#define EXIT_STUCK 3    // neither side has an event left
+#define EXIT_DEADLINE 4 // the next event is past the deadline
+
+extern Statistics statistics;
+
+typedef struct {
+    double values[MAX_POINTS];
+    int n;
+} List;
+
+typedef struct {
+    List sizes, bauds, bers, fers, delays; // fers in %, delays in ms
+    const char *file;                      // sent at every point instead of random files
+    const char *trace;                     // prefix of the trace files, one per point and side
+    const char *format;
+    int header;
+    int tries;
+    int timeout;
+    int deadline;                          // virtual seconds before a point is abandoned
+    int jobs;
+    unsigned long long seed;
+} Options;
+
+// One direction of the line
+typedef struct {
+    unsigned char bytes[SIM_QUEUE];
+    uint64_t due[SIM_QUEUE]; // virtual time each byte reaches the far end
+    uint32_t head, count;
+    uint64_t nextTick;       // first byte tick the line is free
+    uint64_t dropped;        // bytes written to a full queue
+    Prng rng;
+} Line;
+
+typedef struct {
+    sem_t turn;              // posted when the side may run
+    int started;
+    int done;
+    uint64_t timerDue;       // virtual time the timer fires, 0 if disarmed
+    uint64_t timerInterval;
+} Side;
+
+// State shared by the two sides of a point. Only one side runs at a time.
+typedef struct {
+    uint64_t now;            // virtual time since the point started
+    uint64_t byteNs;         // byte time
+    uint64_t inFlight;       // byte times between leaving and arriving
+    double byteErrorRate;
+    uint64_t deadline;
+    uint64_t events;         // turns handed from one side to the other
+    Side sides[2];           // the transmitter, then the receiver
+    Line lines[2];           // lines[i] carries the bytes written by side i
+} Sim;
+
+typedef struct {
+    int index;
+    long long size;
+    int baud;
+    double ber, fer, delayMs;
+    const char *txFile;
+
+    Sim *sim;
+    pid_t pids[2];
+    int status[2];
+    int stats[2][2];         // pipes the sides send their statistics through
+    char rxFile[64];
+    double wallStart;
+
+    int done;
+    int ok;
+    double seconds;          // virtual time of the whole transfer
+    double wallSeconds;
+    Statistics tx, rx;
+} Point;
+
+// The side this process runs, NULL in the parent
+static Sim *sim = NULL;
+static int side = 0;
+static unsigned long long simSeed = 0;
+static uint64_t realtimeBase = 0; // CLOCK_REALTIME when the sweep started
+
+int __real_clock_gettime(clockid_t clock, struct timespec *ts);
+int __real_gettimeofday(struct timeval *tv, void *tz);
+unsigned int __real_alarm(unsigned int seconds);
+int __real_setitimer(int which, const struct itimerval *value, struct itimerval *old);
+void __real_srand(unsigned int seed);
+
+////////////////////////////////////////////////
+// VIRTUAL CLOCK
+////////////////////////////////////////////////
+
+int __wrap_clock_gettime(clockid_t clock, struct timespec *ts)
+{
+    if (sim == NULL) return __real_clock_gettime(clock, ts);
+
+    uint64_t ns = sim->now + (clock == CLOCK_REALTIME ? realtimeBase : SIM_EPOCH_NS);
+    ts->tv_sec = ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+    return 0;
+}
+
+int __wrap_gettimeofday(struct timeval *tv, void *tz)
+{
+    if (sim == NULL) return __real_gettimeofday(tv, tz);
+
+    struct timespec ts;
+    __wrap_clock_gettime(CLOCK_REALTIME, &ts);
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+    return 0;
+}
+
+static uint64_t timerLeft()
+{
+    uint64_t due = sim->sides[side].timerDue;
+    return due > sim->now ? due - sim->now : 0;
+}
+
+unsigned int __wrap_alarm(unsigned int seconds)
+{
+    if (sim == NULL) return __real_alarm(seconds);
+
+    Side *me = &sim->sides[side];
+    unsigned int left = (timerLeft() + 999999999) / 1000000000ULL;
+
+    me->timerDue = seconds > 0 ? sim->now + seconds * 1000000000ULL : 0;
+    me->timerInterval = 0;
+    return left;
+}
+
+int __wrap_setitimer(int which, const struct itimerval *value, struct itimerval *old)
+{
+    if (sim == NULL) return __real_setitimer(which, value, old);
+    if (which != ITIMER_REAL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Side *me = &sim->sides[side];
+    if (old != NULL) {
+        uint64_t left = timerLeft();
+        old->it_value = (struct timeval) {left / 1000000000ULL, left % 1000000000ULL / 1000};
+        old->it_interval = (struct timeval) {me->timerInterval / 1000000000ULL, me->timerInterval % 1000000000ULL / 1000};
+    }
+
+    uint64_t ns = value->it_value.tv_sec * 1000000000ULL + value->it_value.tv_usec * 1000ULL;
+    me->timerDue = ns > 0 ? sim->now + ns : 0;
+    me->timerInterval = value->it_interval.tv_sec * 1000000000ULL + value->it_interval.tv_usec * 1000ULL;
+    return 0;
+}
+
+// The handshake jitter comes from rand(), seeded here so runs repeat
+void __wrap_srand(unsigned int seed)
+{
+    __real_srand(sim != NULL ? (unsigned int) (simSeed * 2 + side) : seed);
+}
+
+////////////////////////////////////////////////
+// SCHEDULER
+////////////////////////////////////////////////
+
+/**
+ * @brief Virtual time of the next event of a side: its timer, or bytes to
+ * read. The parser only completes a frame on a FLAG, so bytes still on their
+ * way are read together with the next FLAG behind them.
+ *
+ * @return uint64_t The time, or NEVER.
+ */
+static uint64_t nextEvent(int which)
+{
+    Side *s = &sim->sides[which];
+    if (s->done) return NEVER;
+    if (!s->started) return sim->now;
+
+    uint64_t event = s->timerDue != 0 ? s->timerDue : NEVER;
+    Line *line = &sim->lines[!which];
+
+    for (uint32_t k = 0; k < line->count; k++) {
+        uint32_t pos = (line->head + k) % SIM_QUEUE;
+        if (line->due[pos] >= event) break;
+        if (k == 0 && line->due[pos] <= sim->now) return sim->now;
+        if (line->bytes[pos] == FLAG) return line->due[pos];
+    }
+
+    return event;
+}
+
+// Let the side with the earliest event run, advancing the clock to it
+static void simWait()
+{
+    uint64_t mine = nextEvent(side);
+    uint64_t theirs = nextEvent(!side);
+    uint64_t next = mine <= theirs ? mine : theirs;
+
+    if (next == NEVER) _exit(EXIT_STUCK);
+    if (next > sim->deadline) _exit(EXIT_DEADLINE);
+    if (next > sim->now) sim->now = next;
+    if (mine <= theirs) return;
+
+    sim->events++;
+    sem_post(&sim->sides[!side].turn);
+    while (sem_wait(&sim->sides[side].turn) == -1 && errno == EINTR) {}
+}
+
+// Hand the clock over for good once this side is done
+static void simFinish()
+{
+    if (sim == NULL || sim->sides[side].done) return;
+
+    sim->sides[side].done = TRUE;
+    uint64_t theirs = nextEvent(!side);
+    if (theirs != NEVER && theirs > sim->now) sim->now = theirs;
+    sem_post(&sim->sides[!side].turn);
+}
+
+////////////////////////////////////////////////
+// LINE
+////////////////////////////////////////////////
+
+static int simOpen(const char *address, int baudRate)
+{
+    return strcmp(address, side == 0 ? "sim:0" : "sim:1") == 0 ? 1 : -1;
+}
+
+static int simClose()
+{
+    return 1;
+}
+
+/**
+ * @brief Read the bytes that have arrived. With none, the timer fires if it is
+ * due, or this side waits for its next event and reads nothing.
+ */
+static int simRead(unsigned char *bytes, int numBytes)
+{
+    Side *me = &sim->sides[side];
+    if (me->timerDue != 0 && me->timerDue <= sim->now) {
+        me->timerDue = me->timerInterval > 0 ? me->timerDue + me->timerInterval : 0;
+        raise(SIGALRM);
+        return 0;
+    }
+
+    Line *line = &sim->lines[!side];
+    int n = 0;
+    while (n < numBytes && line->count > 0 && line->due[line->head] <= sim->now) {
+        bytes[n++] = line->bytes[line->head];
+        line->head = (line->head + 1) % SIM_QUEUE;
+        line->count--;
+    }
+    if (n > 0) return n;
+
+    simWait();
+    return 0;
+}
+
+// Queue bytes on the line, each on the next free byte tick
+static int simWrite(const unsigned char *bytes, int numBytes)
+{
+    Line *line = &sim->lines[side];
+    uint64_t tick = (sim->now + sim->byteNs - 1) / sim->byteNs;
+    if (tick < line->nextTick) tick = line->nextTick;
+
+    for (int i = 0; i < numBytes; i++) {
+        if (line->count == SIM_QUEUE) {
+            line->dropped += numBytes - i;
+            break;
+        }
+
+        unsigned char byte = bytes[i];
+        // at most one wrong bit per byte, as in cable
+        if (sim->byteErrorRate > 0 && prngDouble(&line->rng) < sim->byteErrorRate) byte ^= 1 << (prngNext(&line->rng) % 8);
+
+        uint32_t tail = (line->head + line->count++) % SIM_QUEUE;
+        line->bytes[tail] = byte;
+        line->due[tail] = (tick + sim->inFlight) * sim->byteNs;
+        tick++;
+    }
+
+    line->nextTick = tick;
+    return numBytes;
+}
+
+static const Transport simTransport = {"sim", simOpen, simClose, simRead, simWrite};
+
+////////////////////////////////////////////////
+// SWEEP
+////////////////////////////////////////////////
+
+static double wallSeconds()
+{
+    struct timespec ts;
+    __real_clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parseList(const char *text, List *list)
+{
+    list->n = 0;
+
+    while (*text != '\0' && list->n < MAX_POINTS) {
+        char *end;
+        list->values[list->n++] = strtod(text, &end);
+        if (end == text || (*end != ',' && *end != '\0')) return -1;
+        text = *end == ',' ? end + 1 : end;
+    }
+
+    return *text == '\0' ? 1 : -1;
+}
+
+static int writeRandomFile(const char *path, long long size, unsigned long long seed)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return -1;
+
+    Prng rng;
+    prngSeed(&rng, seed);
+
+    unsigned char block[4096];
+    for (long long pos = 0; pos < size; pos += sizeof(block)) {
+        for (size_t i = 0; i < sizeof(block); i += 8) {
+            uint64_t r = prngNext(&rng);
+            memcpy(block + i, &r, 8);
+        }
+        fwrite(block, 1, size - pos < (long long) sizeof(block) ? size - pos : (long long) sizeof(block), file);
+    }
+
+    return fclose(file) == 0 ? 1 : -1;
+}
+
+static int sameFiles(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    int same = fa != NULL && fb != NULL;
+
+    unsigned char ba[4096], bb[4096];
+    while (same) {
+        size_t na = fread(ba, 1, sizeof(ba), fa), nb = fread(bb, 1, sizeof(bb), fb);
+        if (na != nb || memcmp(ba, bb, na) != 0) same = 0;
+        if (na == 0) break;
+    }
+
+    if (fa != NULL) fclose(fa);
+    if (fb != NULL) fclose(fb);
+    return same;
+}
+
+/**
+ * @brief Run one side of a point in a child: the application layer on its end
+ * of the line, with output discarded, once the clock hands it the first turn.
+ */
+static void runSide(const Options *opt, Point *p, int which)
+{
+    sim = p->sim;
+    side = which;
+    simSeed = opt->seed;
+
+    // the line carries the delay; the receiver only injects frame errors
+    char value[32];
+    snprintf(value, sizeof(value), "%g", p->fer);
+    setenv("LL_BCC2_ERROR", value, 1);
+    snprintf(value, sizeof(value), "%llu", opt->seed);
+    setenv("LL_SEED", value, 1);
+    setenv("LL_TPROPAGATION", "0", 1);
+
+    close(p->stats[which][0]);
+    close(p->stats[!which][0]);
+    close(p->stats[!which][1]);
+    if (freopen("/dev/null", "r", stdin) == NULL || freopen("/dev/null", "w", stdout) == NULL) _exit(1);
+    if (transportAdd(&simTransport) != 1) _exit(1);
+
+    if (opt->trace != NULL) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s-%d-%s.trace", opt->trace, p->index, which == 0 ? "tx" : "rx");
+        if (traceStart(path) != 1) _exit(1);
+    }
+
+    while (sem_wait(&sim->sides[side].turn) == -1 && errno == EINTR) {}
+    sim->sides[side].started = TRUE;
+
+    applicationLayer(which == 0 ? "sim:0" : "sim:1", which == 0 ? "tx" : "rx", p->baud, opt->tries, opt->timeout,
+                     which == 0 ? p->txFile : p->rxFile);
+
+    if (write(p->stats[which][1], &statistics, sizeof(statistics)) != sizeof(statistics)) _exit(1);
+    simFinish();
+    _exit(0);
+}
+
+/**
+ * @brief Set up the line of a point and fork its two sides. The receiver
+ * runs first, as when it is started before the transmitter.
+ *
+ * @return int 1 on success, -1 on error.
+ */
+static int startPoint(const Options *opt, Point *p)
+{
+    p->sim = mmap(NULL, sizeof(Sim), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p->sim == MAP_FAILED) {
+        p->sim = NULL;
+        return -1;
+    }
+
+    Sim *s = p->sim;
+    memset(s, 0, sizeof(*s));
+
+    // as in cable: the byte time is truncated to whole nanoseconds and the
+    // delay rounded to whole byte times
+    s->byteNs = (uint64_t) (1.0e10 / p->baud);
+    uint64_t delayNs = (uint64_t) (p->delayMs * 1e6);
+    s->inFlight = delayNs / s->byteNs + (delayNs % s->byteNs > s->byteNs / 2);
+
+    double byteOk = 1.0 - p->ber;
+    byteOk *= byteOk;
+    byteOk *= byteOk;
+    byteOk *= byteOk;
+    s->byteErrorRate = 1.0 - byteOk;
+    s->deadline = opt->deadline * 1000000000ULL;
+
+    for (int i = 0; i < 2; i++) {
+        prngSeed(&s->lines[i].rng, opt->seed * 2 + i);
+        if (sem_init(&s->sides[i].turn, 1, i == 1) == -1) return -1;
+    }
+
+    snprintf(p->rxFile, sizeof(p->rxFile), "/tmp/link_sim_%d_%p.out", getpid(), (void *) p);
+    if (pipe(p->stats[0]) == -1) return -1;
+    if (pipe(p->stats[1]) == -1) return -1;
+
+    fflush(stdout);
+    p->wallStart = wallSeconds();
+    for (int which = 1; which >= 0; which--) {
+        p->pids[which] = fork();
+        if (p->pids[which] == 0) runSide(opt, p, which);
+        if (p->pids[which] == -1) return -1;
+    }
+
+    close(p->stats[0][1]);
+    close(p->stats[1][1]);
+    return 1;
+}
+
+// Collect the outcome of a point whose sides have both exited
+static void finishPoint(Point *p)
+{
+    p->wallSeconds = wallSeconds() - p->wallStart;
+    p->seconds = p->sim->now / 1e9;
+    p->ok = WIFEXITED(p->status[0]) && WEXITSTATUS(p->status[0]) == 0 &&
+            WIFEXITED(p->status[1]) && WEXITSTATUS(p->status[1]) == 0 &&
+            read(p->stats[0][0], &p->tx, sizeof(p->tx)) == sizeof(p->tx) &&
+            read(p->stats[1][0], &p->rx, sizeof(p->rx)) == sizeof(p->rx) &&
+            sameFiles(p->txFile, p->rxFile);
+
+    close(p->stats[0][0]);
+    close(p->stats[1][0]);
+    remove(p->rxFile);
+    p->done = TRUE;
+}
+
+/**
+ * @brief Best efficiency stop-and-wait can reach at a point, from the same
+ * formula as optimal_efficiency() with the point's BER, injected frame error
+ * rate and delay (as rounded by the line): S = (1 - FER) / (1 + 2a).
+ */
+static double pointOptimalEfficiency(const Point *p)
+{
+    double frameBits = MAX_PAYLOAD_SIZE * 8.0;
+    double delivered = 1.0 - p->fer / 100.0; // 1 - FER
+    for (int i = 0; i < MAX_PAYLOAD_SIZE * 8; i++) delivered *= 1.0 - p->ber;
+
+    double a = (p->sim->inFlight * p->sim->byteNs / 1e9) / (frameBits / p->baud);
+    return delivered / (1 + 2 * a);
+}
+
+static void report(const Options *opt, const Point *p)
+{
+    double goodput = p->ok ? p->size * 8.0 / p->seconds : 0;
+    double efficiency = goodput / p->baud;
+    double speedup = p->wallSeconds > 0 ? p->seconds / p->wallSeconds : 0;
+
+    if (strcmp(opt->format, "json") == 0) {
+        printf("{\"payload\": %d, \"size\": %lld, \"baud\": %d, \"ber\": %g, \"fer\": %g, \"delay_ms\": %g, "
+               "\"ok\": %s, \"seconds\": %.6f, \"goodput_bps\": %.0f, \"efficiency\": %.4f, \"optimal\": %.4f, "
+               "\"frames\": %llu, \"retransmissions\": %llu, \"rx_error_frames\": %llu, \"events\": %llu, "
+               "\"wall_s\": %.4f, \"speedup\": %.0f}\n",
+               MAX_PAYLOAD_SIZE, p->size, p->baud, p->ber, p->fer, p->delayMs, p->ok ? "true" : "false",
+               p->seconds, goodput, efficiency, pointOptimalEfficiency(p),
+               (unsigned long long) p->tx.nFrames, (unsigned long long) p->tx.retransmissions,
+               (unsigned long long) p->rx.errorFrames, (unsigned long long) p->sim->events,
+               p->wallSeconds, speedup);
+        return;
+    }
+
+    printf("%d,%lld,%d,%g,%g,%g,%d,%.6f,%.0f,%.4f,%.4f,%llu,%llu,%llu,%llu,%.4f,%.0f\n",
+           MAX_PAYLOAD_SIZE, p->size, p->baud, p->ber, p->fer, p->delayMs, p->ok, p->seconds, goodput, efficiency,
+           pointOptimalEfficiency(p), (unsigned long long) p->tx.nFrames, (unsigned long long) p->tx.retransmissions,
+           (unsigned long long) p->rx.errorFrames, (unsigned long long) p->sim->events, p->wallSeconds, speedup);
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [--file=F | --sizes=B,...] [--bauds=N,...] [--bers=P,...] [--fers=%%,...]\n"
+           "       [--delays=MS,...] [--jobs=N] [--seed=N] [--format=csv|json] [--no-header]\n"
+           "       [--tries=N] [--timeout=S] [--deadline=S] [--trace=PREFIX]\n"
+           "Times are virtual: --deadline is the link time a point may take. With --trace,\n"
+           "each side of point N writes PREFIX-N-tx.trace or PREFIX-N-rx.trace.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt = {.format = "csv", .header = 1, .tries = 3, .timeout = 4, .deadline = 36000, .seed = 1};
+    opt.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    parseList("65536", &opt.sizes);
+    parseList("9600", &opt.bauds);
+    parseList("0,0.00001", &opt.bers);
+    parseList("0", &opt.fers);
+    parseList("0,10", &opt.delays);
+
+    for (int i = 1; i < argc; i++) {
+        int result = 1;
+        if (strncmp(argv[i], "--file=", 7) == 0) opt.file = argv[i] + 7;
+        else if (strncmp(argv[i], "--sizes=", 8) == 0) result = parseList(argv[i] + 8, &opt.sizes);
+        else if (strncmp(argv[i], "--bauds=", 8) == 0) result = parseList(argv[i] + 8, &opt.bauds);
+        else if (strncmp(argv[i], "--bers=", 7) == 0) result = parseList(argv[i] + 7, &opt.bers);
+        else if (strncmp(argv[i], "--fers=", 7) == 0) result = parseList(argv[i] + 7, &opt.fers);
+        else if (strncmp(argv[i], "--delays=", 9) == 0) result = parseList(argv[i] + 9, &opt.delays);
+        else if (strncmp(argv[i], "--trace=", 8) == 0) opt.trace = argv[i] + 8;
+        else if (strncmp(argv[i], "--jobs=", 7) == 0) opt.jobs = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--seed=", 7) == 0) opt.seed = strtoull(argv[i] + 7, NULL, 0);
+        else if (strncmp(argv[i], "--format=", 9) == 0) opt.format = argv[i] + 9;
+        else if (strcmp(argv[i], "--no-header") == 0) opt.header = 0;
+        else if (strncmp(argv[i], "--tries=", 8) == 0) opt.tries = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--timeout=", 10) == 0) opt.timeout = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--deadline=", 11) == 0) opt.deadline = atoi(argv[i] + 11);
+        else result = -1;
+
+        for (int b = 0; b < opt.bauds.n && result == 1; b++) {
+            if (opt.bauds.values[b] <= 0) result = -1;
+        }
+
+        if (result == -1) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opt.jobs < 1) opt.jobs = 1;
+
+    struct timespec ts;
+    __real_clock_gettime(CLOCK_REALTIME, &ts);
+    realtimeBase = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    // the files to send, one per size
+    char txFiles[MAX_POINTS][32];
+    int nFiles = opt.file != NULL ? 1 : opt.sizes.n;
+    long long sizes[MAX_POINTS];
+    for (int f = 0; f < nFiles; f++) {
+        if (opt.file != NULL) {
+            struct stat st;
+            if (stat(opt.file, &st) == -1) {
+                perror(opt.file);
+                return 1;
+            }
+            sizes[f] = st.st_size;
+            continue;
+        }
+
+        sizes[f] = (long long) opt.sizes.values[f];
+        snprintf(txFiles[f], sizeof(txFiles[f]), "/tmp/link_sim_XXXXXX");
+        int tmp = mkstemp(txFiles[f]);
+        if (tmp == -1 || close(tmp) == -1 || writeRandomFile(txFiles[f], sizes[f], opt.seed + f) != 1) {
+            printf("[ERROR] Unable to create the file to send\n");
+            return 1;
+        }
+    }
+
+    int total = nFiles * opt.bauds.n * opt.bers.n * opt.fers.n * opt.delays.n;
+    Point *points = calloc(total, sizeof(Point));
+    if (points == NULL) return 1;
+
+    int n = 0;
+    for (int f = 0; f < nFiles; f++)
+        for (int b = 0; b < opt.bauds.n; b++)
+            for (int e = 0; e < opt.bers.n; e++)
+                for (int r = 0; r < opt.fers.n; r++)
+                    for (int d = 0; d < opt.delays.n; d++) {
+                        points[n] = (Point) {.index = n, .size = sizes[f], .baud = (int) opt.bauds.values[b],
+                                             .ber = opt.bers.values[e], .fer = opt.fers.values[r],
+                                             .delayMs = opt.delays.values[d],
+                                             .txFile = opt.file != NULL ? opt.file : txFiles[f]};
+                        n++;
+                    }
+
+    if (opt.header && strcmp(opt.format, "csv") == 0) {
+        printf("payload,size,baud,ber,fer,delay_ms,ok,seconds,goodput_bps,efficiency,optimal,"
+               "frames,retransmissions,rx_error_frames,events,wall_s,speedup\n");
+    }
+
+    double start = wallSeconds();
+    double linkSeconds = 0;
+    int next = 0, running = 0, reported = 0, failed = 0;
+
+    while (reported < total) {
+        while (running < opt.jobs && next < total) {
+            if (startPoint(&opt, &points[next]) != 1) {
+                printf("[ERROR] Unable to start a simulation\n");
+                return 1;
+            }
+            next++;
+            running++;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid == -1) break;
+
+        for (int i = 0; i < next; i++) {
+            Point *p = &points[i];
+            int which = p->pids[0] == pid ? 0 : p->pids[1] == pid ? 1 : -1;
+            if (p->done || which == -1) continue;
+
+            p->status[which] = status;
+            p->pids[which] = -1;
+
+            // the other side may be waiting for a turn that never comes
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                if (p->pids[!which] != -1) kill(p->pids[!which], SIGKILL);
+            }
+
+            if (p->pids[!which] == -1) {
+                finishPoint(p);
+                running--;
+            }
+            break;
+        }
+
+        // results come out in sweep order
+        while (reported < next && points[reported].done) {
+            Point *p = &points[reported++];
+            report(&opt, p);
+            fflush(stdout);
+            linkSeconds += p->seconds;
+            if (!p->ok) failed = 1;
+            munmap(p->sim, sizeof(Sim));
+        }
+    }
+
+    fprintf(stderr, "[INFO] %d points, %.1f s of link time simulated in %.2f s\n",
+            total, linkSeconds, wallSeconds() - start);
+
+    for (int f = 0; f < nFiles && opt.file == NULL; f++) remove(txFiles[f]);
+    free(points);
+    return failed;
+}
@@ -1,168 +1,266 @@
 // Application layer protocol implementation
 
+#define _GNU_SOURCE // getdents64
+
 #include "application_layer.h"
 #include "link_layer.h"
 #include "protocol.h"
+#include "scheduler.h"
+#include "hash.h"
+#include "delta.h"
+#include "packet_pool.h"
+#include "log.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #define MAX_FILENAME 100
-#define METADATA_SIZE 20
-
-int readPacketControl(unsigned char *buff, int *isEnd);
-int readPacketData(unsigned char *buff, size_t *newSize, unsigned char *dataPacket);
-int sendPacketControl(unsigned char C, const char *filename, size_t file_size);
+#define MAX_MESSAGE 200
+
+// Chunk the receiver's copy is hashed in when a transfer resumes
+#ifdef LL_NO_HEAP
+#define PREFIX_CHUNK 1024
+#else
+#define PREFIX_CHUNK 65536
+#endif
+
+int sendFile(const char *filename, off_t *batchBytes);
+int sendDirectory(const char *path, int *filesSent, off_t *batchBytes);
+int sendDirectoryEntry(const char *path, const char *name, int *filesSent, off_t *batchBytes);
+int isDirectory(const char *path);
+int openReceivedFile(const char *announcedName, off_t file_size, int resume, int delta);
+int openBatchDirectory();
+int resumeTransfer(int fd, off_t file_size);
+int deltaTransfer(int fd, off_t file_size);
+int readDeltaSource(unsigned char *buffer, size_t size);
+int sendDeltaLiteral(const unsigned char *data, size_t size);
+int sendDeltaCopy(uint32_t block, uint32_t count);
+int sendSignatures(int basis);
+int copyBlocks(uint32_t block, uint32_t count);
+size_t readStream(int fd, unsigned char *buffer);
+ssize_t readFull(int fd, unsigned char *buffer, size_t size);
+int writeFull(int fd, const unsigned char *buffer, size_t size);
+int readPacketResume(unsigned char *buff, int size, off_t *offset, uint64_t *hash);
+int sendPacketResume(off_t offset, int withHash, uint64_t hash);
+void putLittleEndian(unsigned char *bytes, uint64_t value, int n);
+uint64_t hashPrefix(int fd, off_t size, HashState *state);
+off_t checkpointLoad(const char *path, const char *name, off_t file_size);
+void checkpointSave(off_t offset);
+void checkpointRemove();
+int readPacketControl(unsigned char *buff, int size, int *isEnd);
+int readPacketManifest(unsigned char *buff, int size, int *isEnd);
+int readPacketData(unsigned char *buff, int size, size_t *newSize, unsigned char *dataPacket);
+int sendPacketControl(unsigned char C, const char *filename, off_t file_size);
+int sendPacketManifest(int nFiles, off_t totalSize);
 int sendPacketData(size_t nBytes, unsigned char *data);
-unsigned char * sizetouchar(size_t value, unsigned char *size);
-size_t uchartosize (unsigned char n, unsigned char * numbers);
-
-int sequenceNumber = 0;
-size_t totalBytesRead = 0;
+int queueData(unsigned char *packet, size_t nBytes);
+int sendPacketMessage(const char *message, size_t length);
+unsigned char *packetAlloc();
+int queuePacket(unsigned char *packet, int size);
+int openLink(const unsigned char *packet, int size);
+int closeLink(int showStatistics);
+void pollMessages();
+int receiveFilePacket(unsigned char *packet, int size);
+int receiveMessagePacket(unsigned char *packet, int size);
+int sizetouchar(uint64_t value, unsigned char *bytes, unsigned char *size);
+uint64_t uchartosize (unsigned char n, unsigned char * numbers);
+
+uint32_t sequenceNumber = FIRST_DATA_SEQUENCE;
+uint32_t rxSequenceNumber = FIRST_DATA_SEQUENCE;
+off_t totalBytesRead = 0;
+int pollStdin = TRUE;
+int rxFd = -1;
+unsigned char *rxPacket = NULL;
+int isEnd = FALSE;
+int batchIndex = 0;
+int inBatch = FALSE;
+int filesReceived = 0;
+off_t batchBytesRead = 0;
+const char *rxFilename = NULL;
+const char *rxDirectory = NULL;
+int appOptions = 0;
+LinkLayer linkParameters;
+int linkOpen = FALSE;
+char rxName[MAX_FILENAME + 1];
+off_t rxFileSize = 0;
+int checkpointFd = -1;
+char checkpointPath[MAX_FILENAME * 2 + 8];
+int rxBasisFd = -1;
+size_t rxBlockSize = 0;
+uint32_t rxBasisBlocks = 0;
+char rxPath[2 * MAX_FILENAME + 2];
+char rxDeltaPath[2 * MAX_FILENAME + 8];
+off_t deltaLiteralBytes = 0;
+off_t deltaCopiedBytes = 0;
+size_t deltaBlockSizeTx = 0;
+int deltaFd = -1;
+off_t deltaRemaining = 0;
+HashState txHash;
+HashState rxHash;
+int txStream = FALSE;
+int rxStdoutFd = -1;
 
 
 void applicationLayer(const char *serialPort, const char *role, int baudRate,
                       int nTries, int timeout, const char *filename)
 {
-    if(serialPort == NULL || role == NULL || filename == NULL){
-        printf("[ERROR] Initialization error: One or more required arguments are NULL\n");
+    applicationLayerBatch(serialPort, role, baudRate, nTries, timeout, &filename, 1, 0, 0);
+}
+
+void applicationLayerBatch(const char *serialPort, const char *role, int baudRate,
+                           int nTries, int timeout, const char **filenames, int nFiles,
+                           int options, int maxSuspend)
+{
+    if(serialPort == NULL || role == NULL || filenames == NULL || nFiles < 1){
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Initialization error: One or more required arguments are NULL\n");
         return;
     }
 
-    if (strlen(filename) > MAX_FILENAME) {
-        printf("[ALERT] The lenght of the given file name is greater than what is supported: %d characters'\n", MAX_FILENAME);
-        return;
+    appOptions = options;
+    if ((appOptions & APP_DELTA) && (appOptions & APP_RESUME)) {
+        logMessage(LOG_LEVEL_WARNING, "[ALERT] Delta transfers are not resumable, ignoring the resume option\n");
+        appOptions &= ~APP_RESUME;
+    }
+#ifdef LL_NO_HEAP
+    if (appOptions & APP_DELTA) {
+        logMessage(LOG_LEVEL_WARNING, "[ALERT] Delta encoding needs the heap, ignoring the delta option\n");
+        appOptions &= ~APP_DELTA;
+    }
+#endif
+
+    for (int i = 0; i < nFiles; i++) {
+        if (filenames[i] == NULL || strlen(filenames[i]) > MAX_FILENAME) {
+            logMessage(LOG_LEVEL_WARNING, "[ALERT] The lenght of the given file name is greater than what is supported: %d characters'\n", MAX_FILENAME);
+            return;
+        }
+
+        // stdin carries a file of the batch, so none of it can be read as messages
+        if (strcmp(role, "tx") == 0 && strcmp(filenames[i], "-") == 0) pollStdin = FALSE;
     }
         
     LinkLayer connectionParametersApp = {
         .baudRate = baudRate,
         .nRetransmissions = nTries,
-        .timeout = timeout
+        .timeout = timeout,
+        .maxSuspend = maxSuspend
     };
 
     strcpy(connectionParametersApp.serialPort, serialPort);
     connectionParametersApp.role = strcmp(role, "tx") == 0 ? LlTx : LlRx;
 
-    if (llopen(connectionParametersApp) == -1) {
-        printf("[ERROR] Link layer error: Failed to open the connection\n");
+    if (connectionParametersApp.role == LlRx && nFiles != 1) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Initialization error: The receiver takes a single file or directory\n");
         return;
     }
-    
-    if (connectionParametersApp.role == LlTx) {
-        size_t bytesRead = 0;
-        unsigned char *buffer = (unsigned char *) malloc(MAX_PAYLOAD_SIZE + METADATA_SIZE);
-        if(buffer == NULL) {
-            printf("[ERROR] Memory allocation error at buffer creation\n");
-            llclose(FALSE);
-            return;
-        }
 
-        FILE* file = fopen(filename, "rb");
-        if(file == NULL) {
-            printf("[ERROR] File error: Unable to open the file for reading\n");
-            fclose(file);
-            free(buffer);
-            llclose(FALSE);
+    // received data goes to the original stdout, messages to stderr
+    if (connectionParametersApp.role == LlRx && strcmp(filenames[0], "-") == 0) {
+        rxStdoutFd = dup(STDOUT_FILENO);
+        fflush(stdout);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        if (rxStdoutFd < 0) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: Unable to write to stdout\n");
             return;
         }
+    }
+
+    // in 0-RTT mode the transmitter opens the link with its first packet
+    linkParameters = connectionParametersApp;
+    if (connectionParametersApp.role == LlRx || !(appOptions & APP_ZERO_RTT)) {
+        if (openLink(NULL, 0) == -1) return;
+    }
+    
+    if (connectionParametersApp.role == LlTx) {
+        schedulerSetPoll(pollMessages);
 
-        fseek(file, 0, SEEK_END);
-        size_t file_size = ftell(file);
-        rewind(file);
+        int batch = nFiles > 1 || isDirectory(filenames[0]);
+        int filesSent = 0;
+        off_t batchBytes = 0;
 
-        printf("[INFO] Started sending file: '%s'\n", filename);
-        if(sendPacketControl(C_START, filename, file_size) == -1) {
-            printf("[ERROR] Transmission error: Failed to send the START packet control\n");
-            fclose(file);
-            llclose(FALSE);
-            return;
+        for (int i = 0; i < nFiles; i++) {
+            int result;
+
+            if (isDirectory(filenames[i])) {
+                result = sendDirectory(filenames[i], &filesSent, &batchBytes);
+            } else {
+                if (batch) batchIndex = filesSent + 1;
+                result = sendFile(filenames[i], &batchBytes);
+                filesSent++;
+            }
+
+            if (result == -1) {
+                closeLink(FALSE);
+                return;
+            }
         }
 
-        while ((bytesRead = fread(buffer, 1, MAX_PAYLOAD_SIZE, file)) > 0) {
-            
-            if(sendPacketData(bytesRead, buffer) == -1){
-                printf("[ERROR] Transmission error: Failed to send the DATA packet control\n");
-                fclose(file);
-                llclose(FALSE);
+        if (batch) {
+            if (sendPacketManifest(filesSent, batchBytes) == -1) {
+                logMessage(LOG_LEVEL_ERROR, "[ERROR] Transmission error: Failed to send the MANIFEST packet control\n");
+                closeLink(FALSE);
                 return;
             }
         }
 
-        if(sendPacketControl(C_END, filename, file_size) == -1){
-            printf("[ERROR] Transmission error: Failed to send the END packet control\n");
-            fclose(file);
-            llclose(FALSE);
+        if (schedulerFlush() == -1) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Transmission error: Failed to send the queued packets\n");
+            closeLink(FALSE);
             return;
         }
-        printf("[INFO] Finished sending file: '%s'\n", filename);
 
-        fclose(file);
+        if (batch) logMessage(LOG_LEVEL_STATUS, "[INFO] Finished sending batch: %d files, %lld bytes\n", filesSent, (long long) batchBytes);
     } 
     
     if (connectionParametersApp.role == LlRx) {
-        unsigned char * buf = malloc(MAX_PAYLOAD_SIZE + METADATA_SIZE);
-        unsigned char * packet = malloc(MAX_PAYLOAD_SIZE + METADATA_SIZE);
+        unsigned char * buf = poolAlloc(MAX_PAYLOAD_SIZE + METADATA_SIZE);
+        rxPacket = poolAlloc(MAX_PAYLOAD_SIZE + METADATA_SIZE);
 
-        if(buf == NULL || packet == NULL){
-            printf("[ERROR] Initialization error: One or more buffers pointers are NULL\n");
-            llclose(FALSE);
-            return;
-        }
-   
-        FILE *file = fopen(filename, "wb");
-        
-        if(file == NULL) {
-            printf("[ERROR] File error: Unable to open the file for writing\n");
-            fclose(file);
-            llclose(FALSE);
+        if(buf == NULL || rxPacket == NULL){
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Initialization error: One or more buffers pointers are NULL\n");
+            closeLink(FALSE);
             return;
         }
 
-        size_t bytes_readed = 0;
-        int isEnd = FALSE;
+        rxFilename = filenames[0];
+        if (isDirectory(rxFilename)) rxDirectory = rxFilename;
+
+        schedulerSetHandler(CH_FILE, receiveFilePacket);
+        schedulerSetHandler(CH_CONTROL, receiveMessagePacket);
+
+        int bytes_readed = 0;
 
         while(!isEnd){
 
             if((bytes_readed = llread(buf)) == -1) {
-                printf("[ERROR] Link layer error: Failed to read from the link\n");
-                fclose(file);
-                llclose(FALSE);
+                logMessage(LOG_LEVEL_ERROR, "[ERROR] Link layer error: Failed to read from the link\n");
+                if (rxFd >= 0) close(rxFd);
+                closeLink(FALSE);
                 return;
             }
-            
-            if(buf[0] == C_START || buf[0] == C_END){
-
-                if(readPacketControl(buf, &isEnd) == -1) {
-                    printf("[ERROR] Packet error: Failed to read control packet\n");
-                    fclose(file);
-                    llclose(FALSE);
-                    return;
-                }
-
-            } else if(buf[0] == C_DATA){
-                
-                if(readPacketData(buf, &bytes_readed, packet) == -1) {
-                    printf("[ERROR] Packet error: Failed to read data packet\n");
-                    fclose(file);
-                    llclose(FALSE);
-                    return;
-                }
-                fwrite(packet, 1, bytes_readed, file);
-                totalBytesRead += bytes_readed;
+
+            if(schedulerDispatch(buf, bytes_readed) == -1) {
+                if (rxFd >= 0) close(rxFd);
+                closeLink(FALSE);
+                return;
             }
         }
-
-        fclose(file);
     }
 
 
-    if (llclose(TRUE) == -1) {
-        printf("[ERROR] Link layer error: Failed to close the connection\n");
+    if (closeLink(TRUE) == -1) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Link layer error: Failed to close the connection\n");
         return;
     }
 
-    printf("[SUCCESS] Connection closed successfully\n");
+    logWrite("[SUCCESS] Connection closed successfully\n");
 }
 
 
@@ -170,90 +268,902 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
 // AUXILIARY FUNCTIONS
 ////////////////////////////////////////////////
 
-int readPacketControl(unsigned char *buff, int *isEnd)
-{   
-    if (buff == NULL) return -1;
+// Send one file between its own START and END packets
+// Returns 1 on success, -1 on error
+int sendFile(const char *filename, off_t *batchBytes)
+{
+    ssize_t bytesRead = 0;
+    unsigned char *packet = NULL;
 
-    size_t pos = 0;
+    int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+    if(fd < 0) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: Unable to open the file for reading\n");
+        return -1;
+    }
 
-    if(buff[pos] == C_END) *isEnd = TRUE;
-    else if (buff[pos] != C_START) return -1;
+    // pipes, FIFOs and devices are streamed: their length is only known at END
+    struct stat st;
+    off_t file_size = 0;
+    txStream = fstat(fd, &st) == 0 && !S_ISREG(st.st_mode);
 
-    // file size (V1)
-    pos++;
-    if (buff[pos++] != T_FILESIZE) return -1;
-    unsigned char L1 = buff[pos++]; // V1 field size
+    if (txStream) {
+        if (appOptions & (APP_RESUME | APP_DELTA)) {
+            logMessage(LOG_LEVEL_WARNING, "[ALERT] Streams are sent whole, ignoring the resume and delta options\n");
+        }
+    } else {
+        file_size = st.st_size;
+    }
 
-    unsigned char * V1 = malloc(L1);
-    if(V1 == NULL) return -1;
+    // inside a batch the receiver only gets the base name
+    const char *announcedName = filename;
+    if (batchIndex > 0 && strrchr(filename, '/') != NULL) announcedName = strrchr(filename, '/') + 1;
 
-    memcpy(V1, buff + pos, L1);
-    pos += L1;
+    hashInit(&txHash);
+
+    logMessage(LOG_LEVEL_STATUS, "[INFO] Started sending file: '%s'\n", filename);
+    if(sendPacketControl(C_START, announcedName, file_size) == -1) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Transmission error: Failed to send the START packet control\n");
+        close(fd);
+        return -1;
+    }
+
+    if(!txStream && (appOptions & APP_RESUME) && resumeTransfer(fd, file_size) == -1) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Transmission error: Failed to negotiate the resume offset\n");
+        close(fd);
+        return -1;
+    }
+
+    if(!txStream && (appOptions & APP_DELTA) && deltaTransfer(fd, file_size) == -1) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Transmission error: Failed to send the file delta\n");
+        close(fd);
+        return -1;
+    }
+
+    int delta = !txStream && (appOptions & APP_DELTA);
+
+    // the file is read straight into the packet that goes to the scheduler
+    while (!delta && (packet = packetAlloc()) != NULL &&
+           (bytesRead = txStream ? (ssize_t) readStream(fd, packet + DATA_HEADER_SIZE)
+                                 : readFull(fd, packet + DATA_HEADER_SIZE, MAX_PAYLOAD_SIZE)) > 0) {
+        hashUpdate(&txHash, packet + DATA_HEADER_SIZE, bytesRead);
+        if (txStream) file_size += bytesRead;
+
+        // streamed data leaves as soon as it is read
+        if(queueData(packet, bytesRead) == -1 || (txStream && schedulerFlush() == -1)){
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Transmission error: Failed to send the DATA packet control\n");
+            close(fd);
+            return -1;
+        }
+    }
+    poolFree(packet);
+
+    if (!delta && (packet == NULL || bytesRead < 0)) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Transmission error: Failed to send the DATA packet control\n");
+        close(fd);
+        return -1;
+    }
+
+    if(sendPacketControl(C_END, announcedName, file_size) == -1){
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Transmission error: Failed to send the END packet control\n");
+        close(fd);
+        return -1;
+    }
+    logMessage(LOG_LEVEL_STATUS, "[INFO] Finished sending file: '%s'\n", filename);
+
+    *batchBytes += file_size;
+    close(fd);
+    return 1;
+}
+
+#ifdef LL_NO_HEAP
+
+// Send every regular file of a directory, in name order. Without scandir's
+// heap-allocated list, each pass over the directory picks the smallest name
+// after the last one sent. The entries are read with getdents64 into a
+// buffer on the stack, as opendir allocates its own.
+// Returns 1 on success, -1 on error
+int sendDirectory(const char *path, int *filesSent, off_t *batchBytes)
+{
+    char last[256] = "";
+    int result = 1;
+
+    while (result == 1) {
+        int dir = open(path, O_RDONLY | O_DIRECTORY);
+        if (dir < 0) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: Unable to read the directory '%s'\n", path);
+            return -1;
+        }
+
+        char next[256] = "";
+        struct dirent64 entries[4];
+        ssize_t n;
+        while ((n = getdents64(dir, entries, sizeof(entries))) > 0) {
+            for (ssize_t pos = 0; pos < n; pos += ((struct dirent64 *) ((char *) entries + pos))->d_reclen) {
+                const char *name = ((struct dirent64 *) ((char *) entries + pos))->d_name;
+                if (strcmp(name, last) <= 0) continue;
+                if (next[0] == '\0' || strcmp(name, next) < 0) snprintf(next, sizeof(next), "%s", name);
+            }
+        }
+        close(dir);
+
+        if (n < 0) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: Unable to read the directory '%s'\n", path);
+            return -1;
+        }
+
+        if (next[0] == '\0') break;
+        snprintf(last, sizeof(last), "%s", next);
+
+        result = sendDirectoryEntry(path, next, filesSent, batchBytes);
+    }
+
+    return result;
+}
+
+#else
+
+// Send every regular file of a directory, in name order
+// Returns 1 on success, -1 on error
+int sendDirectory(const char *path, int *filesSent, off_t *batchBytes)
+{
+    struct dirent **entries;
+    int n = scandir(path, &entries, NULL, alphasort);
+    if (n < 0) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: Unable to read the directory '%s'\n", path);
+        return -1;
+    }
+
+    int result = 1;
+    for (int i = 0; i < n; i++) {
+        if (result == 1) result = sendDirectoryEntry(path, entries[i]->d_name, filesSent, batchBytes);
+        free(entries[i]);
+    }
+
+    free(entries);
+    return result;
+}
+
+#endif // LL_NO_HEAP
+
+// Send a directory entry if it is a regular file. An entry whose name is
+// longer than the receiver accepts is skipped, so the rest of the batch
+// still goes through.
+// Returns 1 on success (or when the entry is skipped), -1 on error
+int sendDirectoryEntry(const char *path, const char *name, int *filesSent, off_t *batchBytes)
+{
+    char filename[MAX_FILENAME + 256 + 2];
+    snprintf(filename, sizeof(filename), "%s/%s", path, name);
+
+    struct stat st;
+    if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) return 1;
+
+    if (strlen(name) > MAX_FILENAME) {
+        logMessage(LOG_LEVEL_WARNING, "[ALERT] Skipping '%s': file names are limited to %d characters\n", filename, MAX_FILENAME);
+        return 1;
+    }
+
+    batchIndex = *filesSent + 1;
+    (*filesSent)++;
+    return sendFile(filename, batchBytes);
+}
+
+// Returns TRUE if path names an existing directory
+int isDirectory(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Make the receiver's path the directory of a batch, creating it if needed
+// Returns 1 on success, -1 on error
+int openBatchDirectory()
+{
+    if (rxStdoutFd >= 0) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: A batch of files can't be written to stdout\n");
+        return -1;
+    }
+
+    if (mkdir(rxFilename, 0755) == -1 && errno != EEXIST) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: Unable to create the directory '%s' for the batch\n", rxFilename);
+        return -1;
+    }
+
+    if (!isDirectory(rxFilename)) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: '%s' is not a directory, unable to receive the batch\n", rxFilename);
+        return -1;
+    }
+
+    rxDirectory = rxFilename;
+    return 1;
+}
+
+// Open the output file of a transfer. Batch files and files received into
+// a directory keep the base name announced by the transmitter.
+// When the transmitter asks to resume, the checkpoint left by a previous
+// attempt is offered back together with the hash of the data already written.
+// For a delta transfer the new file is assembled next to the old one, which
+// is signed for the transmitter and replaced at END.
+// Returns 1 on success, -1 on error
+int openReceivedFile(const char *announcedName, off_t file_size, int resume, int delta)
+{
+    const char *base = strrchr(announcedName, '/') != NULL ? strrchr(announcedName, '/') + 1 : announcedName;
+    char path[2 * MAX_FILENAME + 2];
+
+    if (inBatch && rxDirectory == NULL && openBatchDirectory() == -1) return -1;
+
+    if (rxDirectory != NULL) snprintf(path, sizeof(path), "%s/%s", rxDirectory, base);
+    else snprintf(path, sizeof(path), "%s", rxFilename);
+
+    if (rxDirectory != NULL &&
+        (base[0] == '\0' || strcmp(base, ".") == 0 || strcmp(base, "..") == 0)) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: Invalid announced file name '%s'\n", announcedName);
+        return -1;
+    }
+
+    snprintf(rxName, sizeof(rxName), "%s", announcedName);
+    rxFileSize = file_size;
+    totalBytesRead = 0;
+    hashInit(&rxHash);
+
+    // stdout has no old copy and cannot be rewound
+    if (rxStdoutFd >= 0 && rxDirectory == NULL) {
+        rxFd = rxStdoutFd;
+        if (delta) return sendSignatures(-1);
+        if (resume && (sendPacketResume(0, TRUE, hashDigest(&rxHash)) == -1 || schedulerFlush() == -1)) return -1;
+        return 1;
+    }
+
+    if (delta) {
+        snprintf(rxPath, sizeof(rxPath), "%s", path);
+        snprintf(rxDeltaPath, sizeof(rxDeltaPath), "%s.delta", path);
+
+        rxBasisFd = open(path, O_RDONLY);
+        rxFd = open(rxDeltaPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(rxFd < 0) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: Unable to open the file for writing\n");
+            return -1;
+        }
+
+        if (sendSignatures(rxBasisFd) == -1) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Transmission error: Failed to send the block signatures\n");
+            return -1;
+        }
 
-    size_t file_size = uchartosize(L1, V1);
-    free(V1);
+        return 1;
+    }
 
-    // name (V2)
-    if(buff[pos++] != T_FILENAME) return -1;
-    unsigned char L2 = buff[pos++]; // V2 field size
+    snprintf(checkpointPath, sizeof(checkpointPath), "%s.ckpt", path);
 
-    char * file_name = malloc(MAX_FILENAME);
-    if(file_name == NULL) return -1;
+    off_t offset = resume ? checkpointLoad(path, announcedName, file_size) : 0;
 
-    memcpy(file_name, buff + pos, L2);
-    file_name[L2] = '\0';
+    rxFd = offset > 0 ? open(path, O_RDWR) : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(rxFd < 0) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: Unable to open the file for writing\n");
+        return -1;
+    }
 
+    checkpointFd = open(checkpointPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (checkpointFd < 0) logMessage(LOG_LEVEL_WARNING, "[ALERT] Unable to create the checkpoint '%s'\n", checkpointPath);
+
+    checkpointSave(offset);
+
+    if (resume) {
+        uint64_t hash = hashPrefix(rxFd, offset, &rxHash);
+        if (sendPacketResume(offset, TRUE, hash) == -1 || schedulerFlush() == -1) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Transmission error: Failed to send the RESUME packet control\n");
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+// Ask the receiver how much of the file it already holds and skip it when
+// the hash of that prefix matches the local file.
+// Returns 1 on success, -1 on error
+int resumeTransfer(int fd, off_t file_size)
+{
+    unsigned char *buf = poolAlloc(MAX_PAYLOAD_SIZE + METADATA_SIZE);
+    if (buf == NULL || schedulerFlush() == -1) {
+        poolFree(buf);
+        return -1;
+    }
+
+    off_t offset = 0;
+    uint64_t hash = 0;
+    int size;
+
+    do {
+        if ((size = llread(buf)) == -1) {
+            poolFree(buf);
+            return -1;
+        }
+    } while (buf[0] != C_RESUME || readPacketResume(buf, size, &offset, &hash) == -1);
+
+    poolFree(buf);
+
+    // the prefix hash also seeds the hash of the whole file sent at END
+    if (offset > file_size || (offset > 0 && hashPrefix(fd, offset, &txHash) != hash)) {
+        logMessage(LOG_LEVEL_WARNING, "[ALERT] The data held by the receiver doesn't match the file, sending it from byte 0\n");
+        hashInit(&txHash);
+        offset = 0;
+    }
+
+    if (sendPacketResume(offset, FALSE, 0) == -1 || lseek(fd, offset, SEEK_SET) < 0) return -1;
+
+    if (offset > 0) logMessage(LOG_LEVEL_STATUS, "[INFO] Resuming from byte %lld of %lld\n", (long long) offset, (long long) file_size);
+    return 1;
+}
+
+// Read whatever a stream has available, up to one packet, waiting only when
+// it has nothing yet.
+// Returns the number of bytes read, 0 at the end of the stream
+size_t readStream(int fd, unsigned char *buffer)
+{
+    ssize_t n;
+
+    do {
+        n = read(fd, buffer, MAX_PAYLOAD_SIZE);
+    } while (n < 0 && errno == EINTR);
+
+    return n > 0 ? n : 0;
+}
+
+// Read size bytes of a file, fewer only at its end
+// Returns the number of bytes read, or -1 on error
+ssize_t readFull(int fd, unsigned char *buffer, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = read(fd, buffer + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += n;
+    }
+
+    return done;
+}
+
+// Write all size bytes to a file
+// Returns 1 on success, -1 on error
+int writeFull(int fd, const unsigned char *buffer, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, buffer, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buffer += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+#ifdef LL_NO_HEAP
+
+// Delta encoding is left out of heap-free builds (the option is dropped)
+int deltaTransfer(int fd, off_t file_size)
+{
+    return -1;
+}
+
+#else
+
+// Get the block signatures of the receiver's copy, then send the file as
+// literals and references to the blocks the receiver already has.
+// Returns 1 on success, -1 on error
+int deltaTransfer(int fd, off_t file_size)
+{
+    unsigned char *buf = poolAlloc(MAX_PAYLOAD_SIZE + METADATA_SIZE);
+    BlockSignature *signatures = NULL;
+    uint32_t nBlocks = 0;
+    int last = FALSE;
+
+    if (buf == NULL || schedulerFlush() == -1) {
+        poolFree(buf);
+        return -1;
+    }
+
+    while (!last) {
+        int size = llread(buf);
+        if (size == -1) {
+            poolFree(buf);
+            free(signatures);
+            return -1;
+        }
+        if (buf[0] != C_SIGNATURE || size < 11) continue;
+
+        uint32_t first = (uint32_t) uchartosize(4, buf + 7);
+        uint32_t count = (size - 11) / 12;
+        if (first != nBlocks) continue;
+
+        last = buf[2];
+        deltaBlockSizeTx = uchartosize(4, buf + 3);
+
+        BlockSignature *grown = realloc(signatures, (nBlocks + count + 1) * sizeof(BlockSignature));
+        if (grown == NULL) {
+            poolFree(buf);
+            free(signatures);
+            return -1;
+        }
+        signatures = grown;
+
+        for (uint32_t i = 0; i < count; i++) {
+            signatures[nBlocks + i].weak = (uint32_t) uchartosize(4, buf + 11 + 12 * i);
+            signatures[nBlocks + i].strong = uchartosize(8, buf + 15 + 12 * i);
+        }
+        nBlocks += count;
+    }
+
+    poolFree(buf);
+
+    // the new file streams through the encoder, hashed on the way
+    deltaFd = fd;
+    deltaRemaining = file_size;
+    deltaLiteralBytes = 0;
+    deltaCopiedBytes = 0;
+    int result = deltaEncode(readDeltaSource, MAX_PAYLOAD_SIZE, signatures, nBlocks, deltaBlockSizeTx,
+                             sendDeltaLiteral, sendDeltaCopy);
+    if (deltaRemaining != 0) result = -1;
+
+    logMessage(LOG_LEVEL_STATUS, "[INFO] Delta: %lld literal bytes, %lld bytes copied from the receiver's %u blocks\n",
+           (long long) deltaLiteralBytes, (long long) deltaCopiedBytes, nBlocks);
+
+    free(signatures);
+    return result;
+}
+
+// Read the next bytes of the file being delta encoded, up to its size
+// Returns the number of bytes read, 0 at the end or -1 on error
+int readDeltaSource(unsigned char *buffer, size_t size)
+{
+    if ((off_t) size > deltaRemaining) size = deltaRemaining;
+
+    ssize_t n = readFull(deltaFd, buffer, size);
+    if (n < 0) return -1;
+
+    hashUpdate(&txHash, buffer, n);
+    deltaRemaining -= n;
+    return n;
+}
+
+#endif // LL_NO_HEAP
+
+// Send a run of literal bytes as data packets
+int sendDeltaLiteral(const unsigned char *data, size_t size)
+{
+    deltaLiteralBytes += size;
+
+    for (size_t pos = 0; pos < size; pos += MAX_PAYLOAD_SIZE) {
+        size_t n = size - pos < MAX_PAYLOAD_SIZE ? size - pos : MAX_PAYLOAD_SIZE;
+        if (sendPacketData(n, (unsigned char *) data + pos) == -1) return -1;
+    }
+
+    return 1;
+}
+
+// Send a reference to count receiver blocks starting at block
+int sendDeltaCopy(uint32_t block, uint32_t count)
+{
+    unsigned char *packet = packetAlloc();
+    if (packet == NULL) return -1;
+
+    packet[0] = C_COPY;
+    packet[1] = CH_FILE;
+    putLittleEndian(packet + 2, block, 4);
+    putLittleEndian(packet + 6, count, 4);
+
+    deltaCopiedBytes += (off_t) count * deltaBlockSizeTx;
+    return queuePacket(packet, 10);
+}
+
+// Send the signatures of every whole block of the receiver's copy, if any
+// Returns 1 on success, -1 on error
+int sendSignatures(int basis)
+{
+    struct stat st;
+    off_t basisSize = 0;
+    if (basis >= 0 && fstat(basis, &st) == 0) basisSize = st.st_size;
+
+#ifdef LL_NO_HEAP
+    // blocks are signed in a pool slot: a copy with larger blocks is not offered
+    if (deltaBlockSize(basisSize) > POOL_SLOT_SIZE) basisSize = 0;
+#endif
+
+    rxBlockSize = deltaBlockSize(basisSize);
+    rxBasisBlocks = basisSize / rxBlockSize;
+
+    unsigned char *block = poolAlloc(rxBlockSize);
+    if (block == NULL) return -1;
+
+    const uint32_t perPacket = (MAX_PAYLOAD_SIZE - 11) / 12;
+    uint32_t index = 0;
+    int result = 1;
+
+    do {
+        unsigned char *packet = packetAlloc();
+        uint32_t count = rxBasisBlocks - index < perPacket ? rxBasisBlocks - index : perPacket;
+        if (packet == NULL) {
+            poolFree(block);
+            return -1;
+        }
+
+        packet[0] = C_SIGNATURE;
+        packet[1] = CH_FILE;
+        packet[2] = index + count == rxBasisBlocks;
+        putLittleEndian(packet + 3, rxBlockSize, 4);
+        putLittleEndian(packet + 7, index, 4);
+
+        for (uint32_t i = 0; i < count; i++) {
+            if (readFull(basis, block, rxBlockSize) != (ssize_t) rxBlockSize) {
+                poolFree(packet);
+                poolFree(block);
+                return -1;
+            }
+            putLittleEndian(packet + 11 + 12 * i, deltaWeak(block, rxBlockSize), 4);
+            putLittleEndian(packet + 15 + 12 * i, deltaStrong(block, rxBlockSize), 8);
+        }
+
+        index += count;
+        result = queuePacket(packet, 11 + 12 * count);
+    } while (result == 1 && index < rxBasisBlocks);
+
+    poolFree(block);
+    return result == 1 ? schedulerFlush() : -1;
+}
+
+// Append count blocks of the receiver's old copy to the new file
+// Returns 1 on success, -1 on error
+int copyBlocks(uint32_t block, uint32_t count)
+{
+    if (rxBasisFd < 0 || block + (uint64_t) count > rxBasisBlocks) return -1;
+
+    unsigned char buffer[4096];
+    off_t remaining = (off_t) count * rxBlockSize;
+    if (lseek(rxBasisFd, (off_t) block * rxBlockSize, SEEK_SET) < 0) return -1;
+
+    while (remaining > 0) {
+        ssize_t n = readFull(rxBasisFd, buffer, remaining < (off_t) sizeof(buffer) ? remaining : sizeof(buffer));
+        if (n <= 0 || writeFull(rxFd, buffer, n) == -1) return -1;
+        hashUpdate(&rxHash, buffer, n);
+        remaining -= n;
+    }
+
+    totalBytesRead += (off_t) count * rxBlockSize;
+    return 1;
+}
+
+// Hash the first size bytes of a file into state, leaving the file
+// positioned right after them
+uint64_t hashPrefix(int fd, off_t size, HashState *state)
+{
+    unsigned char buffer[PREFIX_CHUNK];
+    hashInit(state);
+    lseek(fd, 0, SEEK_SET);
+
+    while (size > 0) {
+        ssize_t n = readFull(fd, buffer, size < (off_t) sizeof(buffer) ? size : sizeof(buffer));
+        if (n <= 0) break;
+        hashUpdate(state, buffer, n);
+        size -= n;
+    }
+
+    return hashDigest(state);
+}
+
+// Read the checkpoint left for path by an interrupted transfer.
+// Returns the offset it records if it belongs to the same file, 0 otherwise.
+off_t checkpointLoad(const char *path, const char *name, off_t file_size)
+{
+    int checkpoint = open(checkpointPath, O_RDONLY);
+    if (checkpoint < 0) return 0;
+
+    char record[2 * 21 + MAX_FILENAME + 2];
+    ssize_t length = readFull(checkpoint, (unsigned char *) record, sizeof(record) - 1);
+    close(checkpoint);
+    if (length < 0) return 0;
+    record[length] = '\0';
+
+    long long size = 0, offset = 0;
+    char savedName[MAX_FILENAME + 1] = "";
+    int fields = sscanf(record, "%lld %lld %100[^\n]", &size, &offset, savedName);
+
+    struct stat st;
+    if (fields != 3 || size != file_size || strcmp(savedName, name) != 0) return 0;
+    if (stat(path, &st) != 0 || st.st_size < offset) return 0;
+
+    return offset;
+}
+
+// Record the highest contiguous offset written to the output file
+void checkpointSave(off_t offset)
+{
+    if (checkpointFd < 0) return;
+
+    char record[2 * 21 + MAX_FILENAME + 2];
+    int length = snprintf(record, sizeof(record), "%020lld %020lld %s\n", (long long) rxFileSize, (long long) offset, rxName);
+
+    // fixed-width record, rewritten in place
+    if (pwrite(checkpointFd, record, length, 0) != length) {
+        logMessage(LOG_LEVEL_WARNING, "[ALERT] Unable to update the checkpoint\n");
+    }
+}
+
+// Drop the checkpoint of a finished transfer
+void checkpointRemove()
+{
+    if (checkpointFd < 0) return;
+
+    close(checkpointFd);
+    checkpointFd = -1;
+    unlink(checkpointPath);
+}
+
+// Receive handler of the file channel
+// Returns 1 on success, -1 on error
+int receiveFilePacket(unsigned char *packet, int size)
+{
+    if(packet[0] == C_START || packet[0] == C_END){
+
+        if(readPacketControl(packet, size, &isEnd) == -1) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Packet error: Failed to read control packet\n");
+            return -1;
+        }
+
+    } else if(packet[0] == C_RESUME){
+        off_t offset = 0;
+        uint64_t hash = 0;
+
+        if(rxFd < 0 || readPacketResume(packet, size, &offset, &hash) == -1) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Packet error: Failed to read resume packet\n");
+            return -1;
+        }
+
+        // the transmitter accepted the offset, or restarts from byte 0
+        if (offset == 0) {
+            if (rxFd != rxStdoutFd && (ftruncate(rxFd, 0) != 0 || lseek(rxFd, 0, SEEK_SET) < 0)) return -1;
+            hashInit(&rxHash);
+        } else {
+            if (lseek(rxFd, offset, SEEK_SET) < 0) return -1;
+            logMessage(LOG_LEVEL_STATUS, "[INFO] Resuming from byte %lld of %lld\n", (long long) offset, (long long) rxFileSize);
+        }
+
+        totalBytesRead = offset;
+        checkpointSave(offset);
+
+    } else if(packet[0] == C_COPY){
+
+        if(size < 10 || copyBlocks((uint32_t) uchartosize(4, packet + 2), (uint32_t) uchartosize(4, packet + 6)) == -1) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Packet error: Failed to copy the referenced blocks\n");
+            return -1;
+        }
+
+    } else if(packet[0] == C_MANIFEST){
+
+        if(readPacketManifest(packet, size, &isEnd) == -1) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Packet error: Failed to read manifest packet\n");
+            return -1;
+        }
+
+    } else if(packet[0] == C_DATA){
+        size_t newSize = 0;
+
+        if(rxFd < 0 || readPacketData(packet, size, &newSize, rxPacket) == -1) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Packet error: Failed to read data packet\n");
+            return -1;
+        }
+        if (writeFull(rxFd, rxPacket, newSize) == -1) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: Unable to write the received data\n");
+            return -1;
+        }
+        hashUpdate(&rxHash, rxPacket, newSize);
+        totalBytesRead += newSize;
+
+        checkpointSave(totalBytesRead);
+    }
+
+    return 1;
+}
+
+// Receive handler of the control channel
+// Returns 1 on success, -1 on error
+int receiveMessagePacket(unsigned char *packet, int size)
+{
+    if(packet[0] != C_MSG || size < 3 || packet[2] > size - 3) return -1;
+
+    logWrite("[MESSAGE] %.*s\n", packet[2], (char *) packet + 3);
+
+    return 1;
+}
+
+int readPacketControl(unsigned char *buff, int size, int *isEnd)
+{   
+    if (buff == NULL) return -1;
+
+    size_t pos = 2;
+    off_t file_size = 0;
+    int batch = 0;
+    int resume = FALSE;
+    int delta = FALSE;
+    int hasHash = FALSE;
+    int stream = FALSE;
+    uint64_t hash = 0;
+
+    char file_name[MAX_FILENAME + 1] = "";
+
+    // TLV parameters, in any order
+    while (pos + 2 <= size) {
+        unsigned char T = buff[pos++];
+        unsigned char L = buff[pos++];
+        if (pos + L > size) break;
+
+        if (T == T_FILESIZE) {
+            file_size = uchartosize(L, buff + pos);
+        } else if (T == T_FILENAME && L <= MAX_FILENAME) {
+            memcpy(file_name, buff + pos, L);
+            file_name[L] = '\0';
+        } else if (T == T_BATCH) {
+            batch = (int) uchartosize(L, buff + pos);
+        } else if (T == T_RESUME) {
+            resume = TRUE;
+        } else if (T == T_DELTA) {
+            delta = TRUE;
+        } else if (T == T_HASH) {
+            hasHash = TRUE;
+            hash = uchartosize(L, buff + pos);
+        } else if (T == T_STREAM) {
+            stream = TRUE;
+        }
+
+        pos += L;
+    }
 
     if(buff[0] == C_START){
-        printf("[INFO] Started receiving file: '%s'\n", file_name);
+        if (batch > 0) inBatch = TRUE;
+        if (rxFd >= 0 || openReceivedFile(file_name, file_size, resume, delta) == -1) return -1;
+
+        logMessage(LOG_LEVEL_STATUS, "[INFO] Started receiving %s: '%s'\n", stream ? "stream" : "file", file_name);
     } else if(buff[0] == C_END){
         if (file_size != totalBytesRead) {
-            printf("[Warning] The received file size doesn't match the original file\n");
+            logMessage(LOG_LEVEL_WARNING, "[Warning] The received file size doesn't match the original file\n");
         }
 
-        printf("[INFO] Finished receiving file: '%s'\n", file_name);
+        if (rxFd >= 0) close(rxFd);
+        rxFd = -1;
+
+        if (hasHash && hash != hashDigest(&rxHash)) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Integrity error: '%s' is corrupted (hash %016llx, expected %016llx)\n",
+                   file_name, (unsigned long long) hashDigest(&rxHash), (unsigned long long) hash);
+            return -1;
+        }
+        checkpointRemove();
+
+        // the new file replaces the old copy only once it is complete
+        if (rxBasisFd >= 0) close(rxBasisFd);
+        rxBasisFd = -1;
+        if (rxDeltaPath[0] != '\0' && rename(rxDeltaPath, rxPath) != 0) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] File error: Unable to replace '%s'\n", rxPath);
+            return -1;
+        }
+        rxDeltaPath[0] = '\0';
+        filesReceived++;
+        batchBytesRead += totalBytesRead;
+
+        // a batch only ends with its manifest
+        if (!inBatch) *isEnd = TRUE;
+
+        logMessage(LOG_LEVEL_STATUS, "[INFO] Finished receiving file: '%s'\n", file_name);
     }
-    
-    free(file_name);
+
     return 1;
 }
 
-int readPacketData(unsigned char *buff, size_t *newSize, unsigned char *dataPacket)
+int readPacketManifest(unsigned char *buff, int size, int *isEnd)
 {
-    if (buff == NULL) return -1;
+    if (buff == NULL || buff[0] != C_MANIFEST) return -1;
+
+    size_t pos = 2;
+    uint64_t nFiles = 0, totalSize = 0;
+
+    while (pos + 2 <= size) {
+        unsigned char T = buff[pos++];
+        unsigned char L = buff[pos++];
+        if (pos + L > size) break;
+
+        if (T == T_FILECOUNT) nFiles = uchartosize(L, buff + pos);
+        else if (T == T_FILESIZE) totalSize = uchartosize(L, buff + pos);
+
+        pos += L;
+    }
+
+    if (nFiles != filesReceived || totalSize != batchBytesRead) {
+        logMessage(LOG_LEVEL_WARNING, "[Warning] The received batch doesn't match the manifest (%llu files, %llu bytes)\n",
+               (unsigned long long) nFiles, (unsigned long long) totalSize);
+    }
+
+    logMessage(LOG_LEVEL_STATUS, "[INFO] Finished receiving batch: %d files, %lld bytes\n", filesReceived, (long long) batchBytesRead);
+
+    *isEnd = TRUE;
+    return 1;
+}
+
+int readPacketResume(unsigned char *buff, int size, off_t *offset, uint64_t *hash)
+{
+    if (buff == NULL || buff[0] != C_RESUME) return -1;
+
+    size_t pos = 2;
+
+    while (pos + 2 <= size) {
+        unsigned char T = buff[pos++];
+        unsigned char L = buff[pos++];
+        if (pos + L > size) break;
+
+        if (T == T_OFFSET) *offset = uchartosize(L, buff + pos);
+        else if (T == T_HASH) *hash = uchartosize(L, buff + pos);
+
+        pos += L;
+    }
+
+    return 1;
+}
+
+int readPacketData(unsigned char *buff, int size, size_t *newSize, unsigned char *dataPacket)
+{
+    if (buff == NULL || size < DATA_HEADER_SIZE) return -1;
     if (buff[0] != C_DATA) return -1;
 
-    *newSize = buff[2] * 256 + buff[3];
-    memcpy(dataPacket, buff + 4, *newSize);
+    // the announced length must fit in what the frame carried
+    *newSize = buff[6] * 256 + buff[7];
+    if ((int) *newSize + DATA_HEADER_SIZE > size) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Packet error: Data packet announces %zu bytes but carries %d\n",
+                   *newSize, size - DATA_HEADER_SIZE);
+        return -1;
+    }
+
+    // packets arrive in order, so a gap means data was lost
+    uint32_t sequence = (uint32_t) uchartosize(4, buff + 2);
+    if (sequence != rxSequenceNumber) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Packet error: Expected data packet %u, got %u\n", rxSequenceNumber, sequence);
+        return -1;
+    }
+    rxSequenceNumber++;
+
+    memcpy(dataPacket, buff + DATA_HEADER_SIZE, *newSize);
 
     return 1;
 }
 
-int sendPacketControl(unsigned char C, const char *filename, size_t file_size)
+int sendPacketControl(unsigned char C, const char *filename, off_t file_size)
 {
     if(filename == NULL) return -1;
     
-    unsigned char L1 = 0;
-    unsigned char * V1 = sizetouchar(file_size, &L1);
-    if(V1 == NULL) return -1;
+    unsigned char V1[sizeof(uint64_t)], L1 = 0;
+    if(sizetouchar(file_size, V1, &L1) == -1) return -1;
 
-    unsigned char L2 = (unsigned char) strlen(filename);
+    // the receiver rejects longer names, and L2 holds one octet
+    size_t nameLength = strlen(filename);
+    if (nameLength > MAX_FILENAME) return -1;
+    unsigned char L2 = (unsigned char) nameLength;
 
-    unsigned char *packet = (unsigned char *) malloc(5 + L1 + L2);
-    if(packet == NULL) {
-        free(V1);
-        return -1;
-    }
+    unsigned char *packet = packetAlloc();
+    if(packet == NULL) return -1;
 
     size_t pos = 0;
     packet[pos++] = C;
-
-    // file size (V1)
-    packet[pos++] = T_FILESIZE;
-    packet[pos++] = L1;
-    memcpy(packet + pos, V1, L1); 
-    pos += L1;
-    free(V1);
+    packet[pos++] = CH_FILE;
+
+    // file size (V1), unknown when a stream starts
+    if (C == C_START && txStream) {
+        packet[pos++] = T_STREAM;
+        packet[pos++] = 0;
+    } else {
+        packet[pos++] = T_FILESIZE;
+        packet[pos++] = L1;
+        memcpy(packet + pos, V1, L1); 
+        pos += L1;
+    }
 
     // file name (V2)
     packet[pos++] = T_FILENAME;
@@ -261,84 +1171,293 @@ int sendPacketControl(unsigned char C, const char *filename, size_t file_size)
     memcpy(packet + pos, filename, L2); 
     pos += L2;  
 
-    int result = llwrite(packet, (int) pos);
+    // position inside a batch (V3)
+    if (batchIndex > 0) {
+        packet[pos++] = T_BATCH;
+        packet[pos++] = 1;
+        packet[pos++] = batchIndex > 255 ? 255 : batchIndex;
+    }
 
-    free(packet);
-    return result;
+    // ask the receiver for its checkpoint (V4, empty)
+    if (C == C_START && !txStream && (appOptions & APP_RESUME)) {
+        packet[pos++] = T_RESUME;
+        packet[pos++] = 0;
+    }
+
+    // ask the receiver for block signatures (V5, empty)
+    if (C == C_START && !txStream && (appOptions & APP_DELTA)) {
+        packet[pos++] = T_DELTA;
+        packet[pos++] = 0;
+    }
+
+    // hash of the whole file (V6)
+    if (C == C_END) {
+        packet[pos++] = T_HASH;
+        packet[pos++] = sizeof(uint64_t);
+        putLittleEndian(packet + pos, hashDigest(&txHash), sizeof(uint64_t));
+        pos += sizeof(uint64_t);
+    }
+
+    return queuePacket(packet, (int) pos);
+}
+
+int sendPacketManifest(int nFiles, off_t totalSize)
+{
+    unsigned char V1[sizeof(uint64_t)], V2[sizeof(uint64_t)], L1 = 0, L2 = 0;
+    if(sizetouchar(nFiles, V1, &L1) == -1 || sizetouchar(totalSize, V2, &L2) == -1) return -1;
+
+    unsigned char *packet = packetAlloc();
+    if(packet == NULL) return -1;
+
+    size_t pos = 0;
+    packet[pos++] = C_MANIFEST;
+    packet[pos++] = CH_FILE;
+
+    // number of files (V1)
+    packet[pos++] = T_FILECOUNT;
+    packet[pos++] = L1;
+    memcpy(packet + pos, V1, L1);
+    pos += L1;
+
+    // total bytes (V2)
+    packet[pos++] = T_FILESIZE;
+    packet[pos++] = L2;
+    memcpy(packet + pos, V2, L2);
+    pos += L2;
+
+    return queuePacket(packet, (int) pos);
 }
 
 int sendPacketData(size_t nBytes, unsigned char *data) 
 {
     if(data == NULL) return -1;
     
-    unsigned char *packet = (unsigned char *) malloc(nBytes + 4);
+    unsigned char *packet = packetAlloc();
     if(packet == NULL) return -1;
-    
+
+    memcpy(packet + DATA_HEADER_SIZE, data, nBytes);
+
+    return queueData(packet, nBytes);
+}
+
+// Fill in the header of a DATA packet whose nBytes of data are already in
+// place after it, and queue it.
+// Returns 1 on success, -1 on error
+int queueData(unsigned char *packet, size_t nBytes)
+{
     packet[0] = C_DATA;
-    packet[1] = (sequenceNumber++) % 100;
-    packet[2] = nBytes >> 8;
-    packet[3] = nBytes & 0xFF;
+    packet[1] = CH_FILE;
+    putLittleEndian(packet + 2, sequenceNumber++, 4);
+    packet[6] = nBytes >> 8;
+    packet[7] = nBytes & 0xFF;
+
+    return queuePacket(packet, nBytes + DATA_HEADER_SIZE);
+}
+
+int sendPacketResume(off_t offset, int withHash, uint64_t hash)
+{
+    unsigned char V1[sizeof(uint64_t)], L1 = 0;
+    if(sizetouchar(offset, V1, &L1) == -1) return -1;
+
+    unsigned char *packet = packetAlloc();
+    if(packet == NULL) return -1;
+
+    size_t pos = 0;
+    packet[pos++] = C_RESUME;
+    packet[pos++] = CH_FILE;
 
-    memcpy(packet + 4, data, nBytes);
+    // offset (V1)
+    packet[pos++] = T_OFFSET;
+    packet[pos++] = L1;
+    memcpy(packet + pos, V1, L1);
+    pos += L1;
+
+    // hash of the bytes before the offset (V2)
+    if (withHash) {
+        packet[pos++] = T_HASH;
+        packet[pos++] = sizeof(uint64_t);
+        putLittleEndian(packet + pos, hash, sizeof(uint64_t));
+        pos += sizeof(uint64_t);
+    }
+
+    return queuePacket(packet, (int) pos);
+}
+
+int sendPacketMessage(const char *message, size_t length)
+{
+    if(message == NULL) return -1;
+    if(length > MAX_MESSAGE) length = MAX_MESSAGE;
+
+#ifdef LL_NO_HEAP
+    // called from the poll hook, which cannot send to make room: leave the
+    // last slot to the frame llwrite builds
+    if (poolAvailable() < 2) return 0;
+#endif
+
+    unsigned char *packet = poolAlloc(length + 3);
+    if(packet == NULL) return -1;
 
-    int result = llwrite(packet, nBytes + 4);
+    packet[0] = C_MSG;
+    packet[1] = CH_CONTROL;
+    packet[2] = (unsigned char) length;
+    memcpy(packet + 3, message, length);
 
-    free(packet);
+    int result = schedulerEnqueue(packet, length + 3);
+    if (result != 1) poolFree(packet);
     return result;
 }
 
-// Function to convert a size_t value to an array of unsigned char (octets)
+// Take a pool slot for a packet. While the pool runs low, queued packets are
+// sent first, so a slot stays free for the frame llwrite builds and one for
+// a message queued by the poll hook.
+// Returns the packet, or NULL on error.
+unsigned char *packetAlloc()
+{
+    while (linkOpen && poolAvailable() < 3) {
+        int result = schedulerSendNext();
+        if (result < 0) return NULL;
+        if (result == 0) break;
+    }
+
+    return poolAlloc(MAX_PAYLOAD_SIZE + METADATA_SIZE);
+}
+
+// Queue a packet from packetAlloc, sending the queued ones while its channel
+// is full. The packet is given back to the pool in every case.
+// Returns 1 on success, -1 on error
+int queuePacket(unsigned char *packet, int size)
+{
+    int result;
+
+    // a START packet that opens the link rides on the SET frame
+    if (!linkOpen) {
+        int early = packet[0] == C_START;
+        result = openLink(early ? packet : NULL, early ? size : 0);
+        if (result == -1 || early) {
+            poolFree(packet);
+            return result;
+        }
+    }
+
+    while ((result = schedulerEnqueue(packet, size)) == 0) {
+        if (schedulerSendNext() < 0) {
+            poolFree(packet);
+            return -1;
+        }
+    }
+
+    if (result != 1) poolFree(packet);
+    return result;
+}
+
+// Open the link, carrying packet in the SET frame when given
+// Returns 1 on success, -1 on error
+int openLink(const unsigned char *packet, int size)
+{
+    if (llopenWithData(linkParameters, packet, size) == -1) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Link layer error: Failed to open the connection\n");
+        return -1;
+    }
+
+    linkOpen = TRUE;
+    return 1;
+}
+
+// Close the link if it was ever opened
+// Returns 1 on success, -1 on error
+int closeLink(int showStatistics)
+{
+    if (!linkOpen) return -1;
+
+    linkOpen = FALSE;
+    return llclose(showStatistics);
+}
+
+// Queue every line typed on stdin as an urgent message, without blocking.
+// The scheduler calls it before every frame the transmitter sends, so a
+// message only ever waits for the frame already in flight.
+void pollMessages()
+{
+    struct pollfd fds = {.fd = STDIN_FILENO, .events = POLLIN};
+
+    while (pollStdin && poll(&fds, 1, 0) > 0) {
+        char line[MAX_MESSAGE + 1];
+        ssize_t n = read(STDIN_FILENO, line, MAX_MESSAGE);
+
+        if (n <= 0) {
+            pollStdin = FALSE;
+            break;
+        }
+        if (line[n - 1] == '\n') n--;
+        if (n == 0) continue;
+
+        if (sendPacketMessage(line, n) != 1) {
+            logMessage(LOG_LEVEL_WARNING, "[ALERT] Control channel full, message dropped\n");
+        }
+    }
+}
+
+// Write the n low octets of value, least significant first
+void putLittleEndian(unsigned char *bytes, uint64_t value, int n)
+{
+    for (int i = 0; i < n; i++) {
+        bytes[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+// Function to convert a 64-bit value to an array of unsigned char (octets)
 /**
- * @brief Converts a size_t value to an array of unsigned char (octets).
+ * @brief Converts a 64-bit value to an array of unsigned char (octets).
  *
- * This function converts a size_t value to an array of unsigned char (octets) and
- * returns the array. The length of the array is stored in the variable pointed to by size.
+ * This function writes the fewest octets that hold a 64-bit value, least
+ * significant first, into bytes. The number of octets is stored in the
+ * variable pointed to by size.
  *
- * @param value The size_t value to be converted.
+ * @param value The value to be converted.
+ * @param bytes Buffer of at least sizeof(uint64_t) octets.
  * @param size Pointer to an unsigned char where the length of the array will be stored.
- * @return unsigned char* Pointer to the array of octets, or NULL if memory allocation fails.
+ * @return int 1 on success, -1 on error.
  */
-unsigned char * sizetouchar(size_t value, unsigned char *size)
+int sizetouchar(uint64_t value, unsigned char *bytes, unsigned char *size)
 {
-    if (size == NULL) return NULL; 
+    if (bytes == NULL || size == NULL) return -1;
     
-    size_t temp = value, l = 0;
+    uint64_t temp = value;
+    size_t l = 0;
 
     do {
         l++;
         temp >>= 8;
     } while (temp);
 
-    unsigned char *bytes = malloc(l);
-    if (bytes == NULL) return NULL;
-
     for (size_t i = 0; i < l; i++) {
         bytes[i] = value & 0xFF;
         value >>= 8;
     }
 
     *size = l;
-    return bytes;
+    return 1;
 }
 
-// Function to convert an array of unsigned char (octets) to a size_t value
+// Function to convert an array of unsigned char (octets) to a 64-bit value
 /**
- * @brief Converts an array of unsigned char (octets) to a size_t value.
+ * @brief Converts an array of unsigned char (octets) to a 64-bit value.
  *
- * This function converts an array of unsigned char (octets) to a size_t value.
+ * This function converts an array of unsigned char (octets) to a 64-bit value.
  *
  * @param n The number of octets in the array.
  * @param numbers Pointer to the array of unsigned char (octets).
- * @return size_t The converted size_t value.
+ * @return uint64_t The converted value.
  */
-size_t uchartosize (unsigned char n, unsigned char * numbers)
+uint64_t uchartosize (unsigned char n, unsigned char * numbers)
 {
     if(numbers == NULL) return 0;
 
-    size_t value = 0;
-    size_t power = 1;
+    uint64_t value = 0;
+    uint64_t power = 1;
 
-    for(int i = 0; i < n; i++) {
+    for(int i = 0; i < n && i < 8; i++) {
         value += numbers[i] * power;
         power <<= 8;
     }
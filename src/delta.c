@@ -0,0 +1,178 @@
+// Delta encoding implementation
+
+#include "delta.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+size_t deltaBlockSize(size_t fileSize)
+{
+    size_t blockSize = DELTA_MIN_BLOCK;
+    while (blockSize < DELTA_MAX_BLOCK && blockSize * blockSize < fileSize) blockSize <<= 1;
+
+    return blockSize;
+}
+
+// rsync checksum: a is the byte sum and b the sum of the running a values,
+// both mod 2^16
+uint32_t deltaWeak(const unsigned char *data, size_t size)
+{
+    uint32_t a = 0, b = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        a += data[i];
+        b += a;
+    }
+
+    return (a & 0xFFFF) | (b << 16);
+}
+
+uint32_t deltaRoll(uint32_t weak, unsigned char out, unsigned char in, size_t blockSize)
+{
+    uint32_t a = weak & 0xFFFF, b = weak >> 16;
+
+    a = (a - out + in) & 0xFFFF;
+    b = (b - (uint32_t) blockSize * out + a) & 0xFFFF;
+
+    return a | (b << 16);
+}
+
+uint64_t deltaStrong(const unsigned char *data, size_t size)
+{
+    HashState state;
+    hashInit(&state);
+    hashUpdate(&state, data, size);
+
+    return hashDigest(&state);
+}
+
+// The match index grows with the receiver's file, so encoding needs the heap
+#ifndef LL_NO_HEAP
+
+/**
+ * @brief Scan the new file for blocks the receiver already has.
+ *
+ * Signatures are indexed by weak checksum in a chained hash table. The
+ * window slides one byte at a time, so a match is found at any offset, and
+ * the strong hash is only computed when the weak checksum hits. Consecutive
+ * matching blocks are merged into a single copy.
+ *
+ * The file streams through a buffer that holds the pending literals (at most
+ * literalSize bytes) and the block under the window. When the window reaches
+ * the end of the buffer, what was already sent is dropped and the buffer is
+ * refilled, so memory doesn't grow with the file.
+ *
+ * @return int Returns 1 on success, -1 on error.
+ */
+int deltaEncode(DeltaRead read, size_t literalSize,
+                const BlockSignature *signatures, uint32_t nBlocks, size_t blockSize,
+                DeltaLiteral literal, DeltaCopy copy)
+{
+    if (read == NULL || literalSize == 0 || blockSize == 0) return -1;
+
+    uint32_t tableSize = 1;
+    while (tableSize < 2 * nBlocks) tableSize <<= 1;
+
+    size_t capacity = blockSize + literalSize;
+    unsigned char *buffer = malloc(capacity);
+    int64_t *table = malloc(tableSize * sizeof(int64_t));
+    int64_t *next = malloc((nBlocks + 1) * sizeof(int64_t));
+    if (buffer == NULL || table == NULL || next == NULL) {
+        free(buffer);
+        free(table);
+        free(next);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < tableSize; i++) table[i] = -1;
+    for (uint32_t i = 0; i < nBlocks; i++) {
+        uint32_t slot = (signatures[i].weak * 2654435761u) & (tableSize - 1);
+        next[i] = table[slot];
+        table[slot] = i;
+    }
+
+    // buffer[literalStart, pos) are pending literals, buffer[pos, end) the
+    // bytes under and ahead of the window
+    int result = 1;
+    int atEnd = 0;
+    int weakValid = 0;
+    size_t literalStart = 0, pos = 0, end = 0;
+    uint32_t runStart = 0, runCount = 0;
+    uint32_t weak = 0;
+
+    while (result == 1) {
+        if (end - pos < blockSize && !atEnd) {
+            memmove(buffer, buffer + literalStart, end - literalStart);
+            pos -= literalStart;
+            end -= literalStart;
+            literalStart = 0;
+
+            while (end < capacity && !atEnd) {
+                int n = read(buffer + end, capacity - end);
+                if (n < 0) result = -1;
+                if (n <= 0) atEnd = 1;
+                else end += n;
+            }
+            continue;
+        }
+        if (end - pos < blockSize) break;
+
+        if (!weakValid) weak = deltaWeak(buffer + pos, blockSize);
+        weakValid = 1;
+
+        int64_t match = -1;
+        uint32_t slot = (weak * 2654435761u) & (tableSize - 1);
+
+        for (int64_t i = table[slot]; i != -1; i = next[i]) {
+            if (signatures[i].weak != weak) continue;
+            if (signatures[i].strong == deltaStrong(buffer + pos, blockSize)) {
+                match = i;
+                break;
+            }
+        }
+
+        if (match == -1) {
+            // a full run of literals goes out before the window moves on
+            if (pos - literalStart == literalSize) {
+                if (runCount > 0) result = copy(runStart, runCount);
+                runCount = 0;
+                if (result == 1) result = literal(buffer + literalStart, literalSize);
+                literalStart = pos;
+            }
+
+            if (pos + blockSize < end) weak = deltaRoll(weak, buffer[pos], buffer[pos + blockSize], blockSize);
+            else weakValid = 0;
+            pos++;
+            continue;
+        }
+
+        // literals go out before the copy that follows them
+        if (pos > literalStart) {
+            if (runCount > 0) result = copy(runStart, runCount);
+            runCount = 0;
+            if (result == 1) result = literal(buffer + literalStart, pos - literalStart);
+        }
+
+        if (runCount > 0 && (uint32_t) match == runStart + runCount) runCount++;
+        else {
+            if (runCount > 0 && result == 1) result = copy(runStart, runCount);
+            runStart = (uint32_t) match;
+            runCount = 1;
+        }
+
+        pos += blockSize;
+        literalStart = pos;
+        weakValid = 0;
+    }
+
+    if (result == 1 && runCount > 0) result = copy(runStart, runCount);
+    if (result == 1 && end > literalStart) result = literal(buffer + literalStart, end - literalStart);
+
+    free(buffer);
+    free(table);
+    free(next);
+    return result;
+}
+
+#endif // LL_NO_HEAP
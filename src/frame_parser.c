@@ -0,0 +1,187 @@
+// Frame parser implementation
+
+#include "frame_parser.h"
+#include "protocol.h"
+
+#include <string.h>
+
+// Parser states
+enum {
+    HUNT,   // out of sync, waiting for a FLAG
+    START,  // FLAG received
+    ADDR,   // address received
+    CTRL,   // control received
+    DATA,   // BCC1 checked, inside the information field
+    ESCAPE, // ESC received inside the information field
+};
+
+// Byte classes
+enum {
+    CL_OTHER,
+    CL_FLAG,
+    CL_ESC,
+    N_CLASSES
+};
+
+// Actions taken on a transition
+enum {
+    ACT_NONE,
+    ACT_ADDR,     // store the address
+    ACT_CTRL,     // store the control field
+    ACT_BCC1,     // check BCC1, resync if it fails
+    ACT_APPEND,   // append the byte to the field
+    ACT_UNESCAPE, // append the escaped byte
+    ACT_END,      // closing FLAG: emit the frame
+    ACT_DROP,     // invalid escape: drop the frame
+};
+
+typedef struct {
+    unsigned char next;
+    unsigned char action;
+} Transition;
+
+static const unsigned char byteClass[256] = {
+    [FLAG] = CL_FLAG,
+    [ESC] = CL_ESC,
+};
+
+static const Transition table[][N_CLASSES] = {
+    //             OTHER                   FLAG               ESC
+    [HUNT]   = {{HUNT, ACT_NONE},     {START, ACT_NONE}, {HUNT, ACT_NONE}},
+    [START]  = {{ADDR, ACT_ADDR},     {START, ACT_NONE}, {HUNT, ACT_NONE}},
+    [ADDR]   = {{CTRL, ACT_CTRL},     {START, ACT_NONE}, {HUNT, ACT_NONE}},
+    [CTRL]   = {{DATA, ACT_BCC1},     {START, ACT_NONE}, {DATA, ACT_BCC1}},
+    [DATA]   = {{DATA, ACT_APPEND},   {START, ACT_END},  {ESCAPE, ACT_NONE}},
+    [ESCAPE] = {{DATA, ACT_UNESCAPE}, {START, ACT_DROP}, {DATA, ACT_UNESCAPE}},
+};
+
+void parserInit(FrameParser *parser, unsigned char *buffer, int capacity)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->state = HUNT;
+    parser->buffer = buffer;
+    parser->capacity = capacity;
+}
+
+void parserSetBuffer(FrameParser *parser, unsigned char *buffer, int capacity)
+{
+    if (parser->buffer == buffer && parser->capacity == capacity) return;
+
+    if (parser->state == DATA || parser->state == ESCAPE) parser->state = HUNT;
+    parser->buffer = buffer;
+    parser->capacity = capacity;
+}
+
+// Append one destuffed byte, dropping the frame when the buffer is full
+static inline void append(FrameParser *parser, unsigned char byte)
+{
+    if (parser->size == parser->capacity) {
+        parser->errors++;
+        parser->state = HUNT;
+        return;
+    }
+
+    parser->buffer[parser->size++] = byte;
+    parser->xor ^= byte;
+}
+
+int parserFeed(FrameParser *parser, const unsigned char *bytes, int n, int *consumed, Frame *frame)
+{
+    const unsigned char *p = bytes, *end = bytes + n;
+
+    while (p < end) {
+        // out of sync: jump straight to the next FLAG
+        if (parser->state == HUNT) {
+            const unsigned char *flag = memchr(p, FLAG, end - p);
+            if (flag == NULL) {
+                p = end;
+                break;
+            }
+            p = flag;
+        }
+
+        // copy a run of plain data bytes without going through the table
+        else if (parser->state == DATA) {
+            int room = parser->capacity - parser->size;
+            unsigned char *w = parser->buffer + parser->size;
+            unsigned char xor = parser->xor;
+
+            while (p < end && room > 0 && byteClass[*p] == CL_OTHER) {
+                xor ^= *p;
+                *w++ = *p++;
+                room--;
+            }
+
+            parser->size = w - parser->buffer;
+            parser->xor = xor;
+            if (p == end) break;
+            if (room == 0 && byteClass[*p] == CL_OTHER) {
+                parser->errors++;
+                parser->state = HUNT;
+                continue;
+            }
+        }
+
+        // a whole supervision frame in one go
+        else if (parser->state == START && end - p >= 4 && p[3] == FLAG &&
+                 byteClass[p[0]] == CL_OTHER && byteClass[p[1]] == CL_OTHER &&
+                 byteClass[p[2]] != CL_FLAG && (p[0] ^ p[1]) == p[2]) {
+            frame->A = parser->A = p[0];
+            frame->C = parser->C = p[1];
+            frame->size = -1;
+            frame->bcc2Ok = 1;
+            frame->escapes = 0;
+            *consumed = p + 4 - bytes;
+            return 1;
+        }
+
+        unsigned char byte = *p++;
+        const Transition *t = &table[parser->state][byteClass[byte]];
+        parser->state = t->next;
+
+        switch (t->action) {
+            case ACT_ADDR:
+                parser->A = byte;
+                break;
+
+            case ACT_CTRL:
+                parser->C = byte;
+                break;
+
+            case ACT_BCC1:
+                if ((parser->A ^ parser->C) != byte) {
+                    parser->errors++;
+                    parser->state = HUNT;
+                }
+                parser->size = 0;
+                parser->xor = 0;
+                parser->escapes = 0;
+                break;
+
+            case ACT_APPEND:
+                append(parser, byte);
+                break;
+
+            case ACT_UNESCAPE:
+                append(parser, byte ^ 0x20);
+                parser->escapes++;
+                break;
+
+            case ACT_DROP:
+                parser->errors++;
+                break;
+
+            case ACT_END:
+                frame->A = parser->A;
+                frame->C = parser->C;
+                frame->size = parser->size > 0 ? parser->size - 1 : -1;
+                frame->bcc2Ok = parser->xor == 0;
+                frame->escapes = parser->escapes;
+                *consumed = p - bytes;
+                return 1;
+        }
+    }
+
+    *consumed = p - bytes;
+    return 0;
+}
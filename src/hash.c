@@ -0,0 +1,123 @@
+// Streaming hash implementation (XXH64)
+
+#include "hash.h"
+
+#include <string.h>
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads, independent of the host byte order
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t merge64(uint64_t acc, uint64_t val)
+{
+    acc ^= round64(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+void hashInit(HashState *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->acc[0] = PRIME1 + PRIME2;
+    state->acc[1] = PRIME2;
+    state->acc[2] = 0;
+    state->acc[3] = -PRIME1;
+}
+
+void hashUpdate(HashState *state, const unsigned char *data, size_t size)
+{
+    const unsigned char *end = data + size;
+    state->total += size;
+
+    // complete a stripe left over from the previous update
+    if (state->buffered > 0) {
+        size_t fill = 32 - state->buffered;
+        if (fill > size) fill = size;
+        memcpy(state->buffer + state->buffered, data, fill);
+        state->buffered += fill;
+        data += fill;
+
+        if (state->buffered < 32) return;
+
+        for (int i = 0; i < 4; i++) state->acc[i] = round64(state->acc[i], read64(state->buffer + 8 * i));
+        state->buffered = 0;
+    }
+
+    // whole 32-byte stripes
+    uint64_t v1 = state->acc[0], v2 = state->acc[1], v3 = state->acc[2], v4 = state->acc[3];
+    while (end - data >= 32) {
+        v1 = round64(v1, read64(data));
+        v2 = round64(v2, read64(data + 8));
+        v3 = round64(v3, read64(data + 16));
+        v4 = round64(v4, read64(data + 24));
+        data += 32;
+    }
+    state->acc[0] = v1; state->acc[1] = v2; state->acc[2] = v3; state->acc[3] = v4;
+
+    memcpy(state->buffer, data, end - data);
+    state->buffered = end - data;
+}
+
+uint64_t hashDigest(const HashState *state)
+{
+    uint64_t h;
+
+    if (state->total >= 32) {
+        h = rotl(state->acc[0], 1) + rotl(state->acc[1], 7) + rotl(state->acc[2], 12) + rotl(state->acc[3], 18);
+        for (int i = 0; i < 4; i++) h = merge64(h, state->acc[i]);
+    } else {
+        h = state->acc[2] + PRIME5;
+    }
+
+    h += state->total;
+
+    const unsigned char *p = state->buffer, *end = state->buffer + state->buffered;
+    while (end - p >= 8) {
+        h ^= round64(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t) read32(p) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p++) * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+
+    return h;
+}
@@ -0,0 +1,42 @@
+// Latency histogram implementation
+
+#include "histogram.h"
+
+#include <stdio.h>
+
+// Largest value that falls in a bucket
+static uint64_t bucketTop(int index)
+{
+    if (index < HISTOGRAM_SUB) return index;
+
+    int group = index >> HISTOGRAM_SUB_BITS;        // power of two, from 1
+    uint64_t sub = index & (HISTOGRAM_SUB - 1);
+    int shift = group - 1;
+
+    return ((HISTOGRAM_SUB + sub + 1) << shift) - 1;
+}
+
+uint64_t histogramPercentile(const Histogram *h, double p)
+{
+    if (h->count == 0) return 0;
+
+    uint64_t rank = (uint64_t) (p * h->count + 0.5);
+    if (rank < 1) rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) return bucketTop(i) < h->max ? bucketTop(i) : h->max;
+    }
+
+    return h->max;
+}
+
+void histogramPrint(const char *name, const Histogram *h)
+{
+    if (h->count == 0) return;
+
+    printf("%31s: %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, (unsigned long long) h->count,
+           h->sum / (double) h->count / 1000.0, histogramPercentile(h, 0.50) / 1000.0,
+           histogramPercentile(h, 0.90) / 1000.0, histogramPercentile(h, 0.99) / 1000.0, h->max / 1000.0);
+}
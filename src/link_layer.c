@@ -4,7 +4,15 @@
 #include "serial_port.h"
 #include "protocol.h"
 #include "statistics.h"
-
+#include "frame_parser.h"
+#include "packet_pool.h"
+#include "trace.h"
+#include "log.h"
+#include "metrics.h"
+#include "prng.h"
+#include "transport.h"
+
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,33 +23,64 @@
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
+#include <sys/time.h>
 
 // MISC
 #define _POSIX_SOURCE 1 // POSIX compliant source
 
-typedef enum {
-    START_STATE, 
-    FLAG_RCV,
-    A_RCV, 
-    C_RCV, 
-    BCC_OK, 
-    STOP_STATE,
-    DATA_STATE,
-    ESC_STATE
-} LinkLayerState;
+// Handshake retry schedule: the first retry goes out once the frame and the
+// answer could have crossed the line, plus HANDSHAKE_MARGIN_MS for the peer to
+// answer, and the interval doubles up to the configured timeout
+#define HANDSHAKE_MARGIN_MS 5
+#define HANDSHAKE_JITTER 4 // intervals vary by up to 1/HANDSHAKE_JITTER
+
+// Keepalive period while a silent link is suspended
+#define KEEPALIVE_MS 500
+
+// Bytes read from the serial port at once
+#define RX_CHUNK_SIZE 4096
+
+// Responses that can be held back at once to simulate the propagation delay
+#define DELAYED_FRAMES 8
+
+// Sequence numbers as recorded in the trace
+#define TRACE_SEQ (C_Ns | C_Nr << 1)
 
 void alarmHandler(int signal);
+void handshakeAlarmHandler(int signal);
 void alarmDisable();
+void setTimerMs(int ms);
+int handshakeArm(int interval);
+int handshakeFirstInterval(int frameSize);
 void nextNs();
 void nextNr();
 void showStatisticsTerminal();
-int destuffing(unsigned char *buf, int bufSize, int *newSize, unsigned char *BCC2);
+void showLinkBytes();
+unsigned char *buildFrame(unsigned char A, unsigned char C, const unsigned char *buf, int bufSize, int *frameSize);
 int sendCommandFrame(unsigned char A, unsigned char C);
+static int configureFaults(const LinkLayer *parameters);
+static int sendDelayedFrame(unsigned char A, unsigned char C);
+static int sendOldestDelayedFrame();
+static int sendDueFrames(int all);
+static int timedWrite(const unsigned char *bytes, int numBytes);
+static void countSent(int frameSize, int infoSize);
+static void countResent(int frameSize);
+static void countProbe(int frameSize);
+static void countReceived(const Frame *frame, const unsigned char *packet, int delivered);
+static void countDelivered(const unsigned char *packet, int size);
+int nextFrame(Frame *frame, unsigned char *buffer, int capacity);
+int answerFrame(const Frame *frame);
 int receiveFrame(unsigned char A_EXPECTED, unsigned char C_EXPECTED);
+int receiveSetFrame();
 int receiveRetransmissionFrame(unsigned char A_EXPECTED, unsigned char C_EXPECTED, unsigned char A_SEND, unsigned char C_SEND);
+int retransmitFrame(const unsigned char *frame, int frameSize, unsigned char A_EXPECTED, unsigned char C_EXPECTED);
 
 int alarmEnabled = FALSE;
 int alarmCount = 0;
+int handshakeBackoff = FALSE;
+int suspended = FALSE;
+int MAX_SUSPEND = 0; // seconds, 0: no suspension, -1: no limit
+struct timeval suspendTime;
 int RETRANSMISSIONS = 0;
 int TIMEOUT = 0;
 LinkLayerRole ROLE;
@@ -51,41 +90,121 @@ unsigned char C_Nr = 0;
 
 Statistics statistics = {0, 0, 0, 0.0};
 
+// Packet piggybacked on the SET frame, handed out by the first llread
+unsigned char earlyData[MAX_PAYLOAD_SIZE + METADATA_SIZE];
+int earlyDataSize = 0;
+
+// Received bytes not parsed yet, and the parser shared by every receive path
+unsigned char rxChunk[RX_CHUNK_SIZE];
+int rxChunkPos = 0;
+int rxChunkSize = 0;
+FrameParser parser;
+
+// Start of the current run of empty reads, 0 while bytes are arriving
+uint64_t idleSince = 0;
+
+// Generator of the simulated faults
+Prng faultRng;
+
+// Responses waiting for their simulated propagation delay, oldest first
+typedef struct {
+    uint64_t due; // CLOCK_MONOTONIC time to send it
+    unsigned char A;
+    unsigned char C;
+} DelayedFrame;
+
+DelayedFrame delayedFrames[DELAYED_FRAMES];
+int delayedHead = 0;
+int delayedCount = 0;
+
+// Information fields of frames that llread doesn't take
+unsigned char frameBuffer[MAX_PAYLOAD_SIZE + METADATA_SIZE];
+
 ////////////////////////////////////////////////
 // LLOPEN
 ////////////////////////////////////////////////
 int llopen(LinkLayer connectionParameters)
 {
+    return llopenWithData(connectionParameters, NULL, 0);
+}
+
+////////////////////////////////////////////////
+// LLOPEN (0-RTT)
+////////////////////////////////////////////////
+int llopenWithData(LinkLayer connectionParameters, const unsigned char *buf, int bufSize)
+{
+    if (bufSize < 0 || bufSize > MAX_PAYLOAD_SIZE + METADATA_SIZE) return -1;
+
+    logStart();
+
     if (openSerialPort(connectionParameters.serialPort, connectionParameters.baudRate) < 0) return -1;
 
     BAUDRATE = connectionParameters.baudRate;
     ROLE = connectionParameters.role;
     RETRANSMISSIONS = connectionParameters.nRetransmissions;
     TIMEOUT = connectionParameters.timeout;
+    MAX_SUSPEND = connectionParameters.maxSuspend;
+    if (configureFaults(&connectionParameters) != 1) {
+        closeSerialPort();
+        return -1;
+    }
+
+    rxChunkPos = rxChunkSize = 0;
+    delayedCount = 0;
+    idleSince = 0;
+    traceSetLink(ROLE, BAUDRATE);
+    metricSet(role, ROLE);
+    metricSet(rtoMs, TIMEOUT * 1000);
+    traceEvent(TRACE_STATE, 0, 0, TRACE_SEQ, TRACE_OPENING);
+    parserInit(&parser, frameBuffer, sizeof(frameBuffer));
+
+    // seed random number generator (both ends jitter their handshake retries)
+    srand(time(NULL) ^ getpid());
+
+    struct timeval openTime;
+    gettimeofday(&openTime, NULL);
 
     switch (ROLE) {
 
-        case LlTx:
+        case LlTx: {
+
+            // with data, the SET frame carries it like an I-frame and UA acknowledges both
+            int frameSize = 0;
+            unsigned char *frame = buildFrame(A_T, C_SET, buf, buf != NULL ? bufSize : 0, &frameSize);
+            if (frame == NULL) return -1;
+
+            countSent(frameSize, buf != NULL && bufSize > 0 ? bufSize : -1);
+            int result = retransmitFrame(frame, frameSize, A_T, C_UA);
+            poolFree(frame);
+            if (result != 1) return -1;
+            if (buf != NULL && bufSize > 0) countDelivered(buf, bufSize);
 
-            if (receiveRetransmissionFrame(A_T, C_UA, A_T, C_SET) != 1) return -1;
             gettimeofday(&statistics.startTime, NULL);
+            statistics.connectTime = timeDiff(openTime, statistics.startTime);
+            statistics.idleNs = 0; // waiting for the peer to connect isn't counted
             statistics.nFrames++;
 
-            printf("[STATUS] Connection Established!\n");
+            traceEvent(TRACE_STATE, 0, 0, TRACE_SEQ, TRACE_CONNECTED);
+            metricSet(linkUp, TRUE);
+            logMessage(LOG_LEVEL_STATUS, "[STATUS] Connection Established!\n");
 
             break;
+        }
 
         case LlRx:
 
-            if (receiveFrame(A_T, C_SET) != 1) return -1;
+            if (receiveSetFrame() != 1) return -1;
             gettimeofday(&statistics.startTime, NULL);
+            statistics.connectTime = timeDiff(openTime, statistics.startTime);
+            statistics.idleNs = 0;
             statistics.nFrames++;
             statistics.bytesRead += 5;
-            srand(time(NULL)); // seed random number generator
 
             if (sendCommandFrame(A_T, C_UA) != 1) return -1;
 
-            printf("[STATUS] Connection Established!\n");
+            traceEvent(TRACE_STATE, 0, 0, TRACE_SEQ, TRACE_CONNECTED);
+            metricSet(linkUp, TRUE);
+            logMessage(LOG_LEVEL_STATUS, "[STATUS] Connection Established!\n");
 
             break;
     }
@@ -98,157 +217,146 @@ int llopen(LinkLayer connectionParameters)
 ////////////////////////////////////////////////
 int llwrite(const unsigned char *buf, int bufSize) 
 {
-    if (buf == NULL) return -1;
-
-    int frameSize = bufSize + 6;
-    unsigned char *frame = malloc(frameSize);
-
-    // Create frame header
-    frame[0] = FLAG;
-    frame[1] = A_T;
-    frame[2] = C_Ns ? C_INF(1) : C_INF(0);
-    frame[3] = frame[1] ^ frame[2];
-    memcpy(frame + 4, buf, bufSize);
-
-    unsigned char BCC2 = buf[0];
-    for (int i = 1; i < bufSize; i++) {
-        BCC2 ^= buf[i];
-    }
-
-    // Data and stuffing
-    int pos = 4;
-    for (int i = 0; i < bufSize; i++) {
-        switch (buf[i]) {
-            case FLAG:
-                frame = realloc(frame, ++frameSize);
-                frame[pos++] = ESC;
-                frame[pos++] = SUF_FLAG;
-                break;
-
-            case ESC:
-                frame = realloc(frame, ++frameSize);
-                frame[pos++] = ESC;
-                frame[pos++] = SUF_ESC;
-                break;
-
-            default:
-                frame[pos++] = buf[i];
-                break;
-        }
-    }
-    
-    // tail
-    frame[pos++] = BCC2;
-    frame[pos++] = FLAG;
+    if (buf == NULL || bufSize < 1) return -1;
 
+    int frameSize = 0;
+    uint64_t encodeStart = monotonicNs();
+    unsigned char *frame = buildFrame(A_T, C_Ns ? C_INF(1) : C_INF(0), buf, bufSize, &frameSize);
+    if (frame == NULL) return -1;
+    histogramRecord(&statistics.encodeTime, monotonicNs() - encodeStart);
 
     // Send frame
-    LinkLayerState state = START_STATE;
-
     (void)signal(SIGALRM, alarmHandler);
 
-    if (writeBytesSerialPort(frame, frameSize) < 0) {
-        free(frame);
-        printf("[ERROR] Error writing send command\n");
+    if (timedWrite(frame, frameSize) < 0) {
+        poolFree(frame);
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Error writing send command\n");
         return -1;
     }
+    countSent(frameSize, bufSize);
+    traceEvent(TRACE_SEND, frame[1], frame[2], TRACE_SEQ, frameSize);
+    uint64_t sentTime = monotonicNs();
+    uint64_t lastSentTime = sentTime;
+    int sends = 1;
+    metricSet(window, 1);
 
     alarm(TIMEOUT);
 
-    unsigned char byte_C = 0, byte_A = 0; 
-
-    while (state != STOP_STATE && alarmCount <= RETRANSMISSIONS) 
+    while (TRUE) 
     {
-        int result;
-        unsigned char byte;
-        
-        if ((result = readByteSerialPort(&byte)) < 0) {
-            free(frame);
-            printf("[ERROR] Error reading response\n");
-            return -1;
-        }
-
-        else if (result > 0) {
-            switch (state) {
+        Frame response;
+        int result = nextFrame(&response, frameBuffer, sizeof(frameBuffer));
 
-                case START_STATE:
-                    byte_C = 0;
-                    byte_A = 0;
-                    if (byte == FLAG) state = FLAG_RCV;
-                    break;
-
-                case FLAG_RCV:
-                    if (byte == A_R || byte == A_T) {
-                        state = A_RCV;
-                        byte_A = byte;
-                    }
-                    else if (byte != FLAG) state = START_STATE;
-                    break;
-
-                case A_RCV:
-                    if (byte == C_RR(0) || byte == C_RR(1) || byte == C_REJ(0) || byte == C_REJ(1)) {
-                        state = C_RCV;
-                        byte_C = byte;
-                    }
-                    else if (byte == FLAG) state = FLAG_RCV;
-                    else state = START_STATE;
-                    break;
-
-                case C_RCV:
-                    if (byte == FLAG) state = FLAG_RCV;
-                    else if ((byte_A ^ byte_C) == byte) state = BCC_OK;
-                    else state = START_STATE;
-                    break;
+        if (result < 0) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Error reading response\n");
+            break;
+        }
 
-                case BCC_OK:
-                    if (byte == FLAG) state = STOP_STATE;
-                    else state = START_STATE;
-                    break;
+        unsigned char byte_C = response.C;
+        int isAnswer = result > 0 && response.size < 0 && (response.A == A_R || response.A == A_T) &&
+                       (byte_C == C_RR(0) || byte_C == C_RR(1) || byte_C == C_REJ(0) || byte_C == C_REJ(1));
 
-                default:
-                    state = START_STATE;
+        if (isAnswer) {
 
+            if (suspended) {
+                struct timeval now;
+                gettimeofday(&now, NULL);
+                suspended = FALSE;
+                metricSet(suspended, FALSE);
+                traceEvent(TRACE_STATE, 0, 0, TRACE_SEQ, TRACE_RESUMED);
+                logMessage(LOG_LEVEL_STATUS, "[STATUS] Link back after %f seconds, resuming the session\n", timeDiff(suspendTime, now));
             }
-        }
-
-        if (state == STOP_STATE) {
 
             if (byte_C == C_REJ(0) || byte_C == C_REJ(1)) {
+                metricAdd(framesRejected, 1);
                 alarmEnabled = TRUE;
                 alarmCount = 0;
-                printf("[ALERT] Frame rejected, resending frame\n");
+                logMessage(LOG_LEVEL_FRAME, "[ALERT] Frame rejected, resending frame\n");
             }
 
-            else if (byte_C == C_RR(0) || byte_C == C_RR(1)) {
+            // the receiver still expects this frame (e.g. answer to a keepalive)
+            else if (byte_C == C_RR(C_Ns)) {
+                alarmEnabled = TRUE;
+                alarmCount = 0;
+            }
+
+            else {
                 statistics.nFrames++;
+                uint64_t now = monotonicNs();
+                histogramRecord(&statistics.ackTime, now - sentTime);
+                if (sends == 1) metricsRecordRtt(now - lastSentTime);
+                metricSet(window, 0);
+                countDelivered(buf, bufSize);
 
                 alarmDisable();
                 nextNs();
-                free(frame);
+                poolFree(frame);
                 return bufSize;
             } 
 
         }
 
+        // the peer may be writing too, e.g. it missed our RR for its last frame
+        else if (result > 0 && answerFrame(&response) < 0) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Error sending response\n");
+            break;
+        }
+
         if (alarmEnabled) {
 
             alarmEnabled = FALSE;
 
-            if (alarmCount <= RETRANSMISSIONS) {
-                if (writeBytesSerialPort(frame, frameSize) < 0) {
-                    printf("[ERROR] Error writing send command\n");
-                    return -1;
+            // out of retries: fail as before, or keep the session and probe the line with keepalives
+            if (!suspended && alarmCount > RETRANSMISSIONS && MAX_SUSPEND == 0) {
+                logMessage(LOG_LEVEL_ERROR, "[ERROR] Maximum number of retransmissions reached\n");
+                break;
+            }
+
+            if (!suspended && alarmCount > RETRANSMISSIONS) {
+                suspended = TRUE;
+                metricSet(suspended, TRUE);
+                traceEvent(TRACE_STATE, 0, 0, TRACE_SEQ, TRACE_SUSPENDED);
+                gettimeofday(&suspendTime, NULL);
+                logMessage(LOG_LEVEL_WARNING, "[ALERT] Link silent, suspending the session\n");
+            }
+
+            if (suspended) {
+                struct timeval now;
+                gettimeofday(&now, NULL);
+
+                if (MAX_SUSPEND > 0 && timeDiff(suspendTime, now) > MAX_SUSPEND) {
+                    logMessage(LOG_LEVEL_ERROR, "[ERROR] Link down for more than %d seconds\n", MAX_SUSPEND);
+                    break;
                 }
 
-                alarm(TIMEOUT);
+                if (sendCommandFrame(A_T, C_KEEPALIVE) != 1) {
+                    logMessage(LOG_LEVEL_ERROR, "[ERROR] Error writing keepalive\n");
+                    break;
+                }
+
+                setTimerMs(KEEPALIVE_MS);
             }
 
-            state = START_STATE;
+            else {
+                if (timedWrite(frame, frameSize) < 0) {
+                    logMessage(LOG_LEVEL_ERROR, "[ERROR] Error writing send command\n");
+                    break;
+                }
+                countResent(frameSize);
+                traceEvent(TRACE_RESEND, frame[1], frame[2], TRACE_SEQ, frameSize);
+                lastSentTime = monotonicNs();
+                sends++;
+
+                alarm(TIMEOUT);
+            }
         }
     }
 
+    suspended = FALSE;
+    metricSet(suspended, FALSE);
+    metricSet(window, 0);
     alarmDisable();
-    free(frame);
+    poolFree(frame);
 
     return -1;
 }
@@ -258,139 +366,86 @@ int llwrite(const unsigned char *buf, int bufSize)
 ////////////////////////////////////////////////
 int llread(unsigned char *packet) 
 {
-    usleep(TPROPAGATION * 1000); // simulate propagation delay in ms
-
-    unsigned char byte_C = 0;
-    int pos = 0;
-
-    LinkLayerState state = START_STATE;
+    if (earlyDataSize > 0) {
+        int size = earlyDataSize;
+        memcpy(packet, earlyData, size);
+        earlyDataSize = 0;
+        return size;
+    }
 
-    while (state != STOP_STATE) 
+    while (TRUE) 
     {
-        int result;
-        unsigned char byte = 0;
-        
-        if ((result = readByteSerialPort(&byte)) < 0) {
-            printf("[ERROR] Error reading response\n");
+        Frame frame;
+        int result = nextFrame(&frame, packet, MAX_PAYLOAD_SIZE + METADATA_SIZE);
+
+        if (result < 0) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Error reading response\n");
             return -1;
         }
+        if (result == 0) continue;
 
-        else if (result > 0) {
-            switch (state) {
+        // a keepalive, or a repeated SET from a transmitter that missed our UA
+        if (frame.A != A_T || frame.size < 0 || (frame.C != C_INF(0) && frame.C != C_INF(1))) {
+            if (answerFrame(&frame) < 0) {
+                logMessage(LOG_LEVEL_ERROR, "[ERROR] Error sending response\n");
+                return -1;
+            }
+            continue;
+        }
 
-                case START_STATE:
-                    pos = 0;
-                    byte_C = 0;
-                    if (byte == FLAG) state = FLAG_RCV;
-                    break;
+        unsigned char byte_C = frame.C;
+        int expected = byte_C == C_INF(C_Nr);
+        unsigned char C_;   // the response frame
 
-                case FLAG_RCV:
-                    if (byte == A_T) state = A_RCV;
-                    else if (byte != FLAG) state = START_STATE;
-                    break;
+        if (frame.bcc2Ok || !expected) {
+            // BCC2 correct, or a duplicate whose data we already have: send a positive acknowledgment (RR)
+            C_ = (byte_C == C_INF(0)) ? C_RR(1) : C_RR(0);
+        } 
+        
+        else {
+            // BCC2 incorrect on the expected frame, send a negative acknowledgment (REJ)
+            C_ = (byte_C == C_INF(0)) ? C_REJ(0) : C_REJ(1);
+        }
+    
+        // Simulate probability of error in BCC1 and BCC2
+        // Use only for testing purposes
+        if (expected) {
+            if (prngDouble(&faultRng) * 100 < faults.bcc1Error) {
+                statistics.errorFrames++;
+                countReceived(&frame, packet, FALSE);
+                continue;
+            }
 
-                case A_RCV:
-                    if (byte == C_INF(0) || byte == C_INF(1)) {
-                        state = C_RCV;
-                        byte_C = byte;
-                    }
-                    else if (byte == FLAG) state = FLAG_RCV;
-                    else state = START_STATE;
-                    break;
+            if (prngDouble(&faultRng) * 100 < faults.bcc2Error) C_ = (byte_C == C_INF(0)) ? C_REJ(0) : C_REJ(1);
 
-                case C_RCV:
-                    if ((A_T ^ byte_C) == byte) state = DATA_STATE;
-                    else {
-                        if (byte == FLAG) state = FLAG_RCV;
-                        else state = START_STATE;
-                        statistics.errorFrames++;
-                    }
-                    break;
+        }
 
-                case DATA_STATE:
-                    if (byte == FLAG) {
-                        int newSize = 0;
-                        unsigned char BCC2 = 0;
-
-                        if (destuffing(packet, pos, &newSize, &BCC2) != 1) {
-                            printf("[ERROR] Error destuffing\n");
-                            return -1;
-                        }
-
-                        // create BCC2
-                        unsigned char xor = packet[0];
-                        for (int i = 1; i < newSize; i++) {
-                            xor ^= packet[i];
-                        }
-
-                        unsigned char C_;   // the response frame
-
-                        if (xor == BCC2) {
-                            // BCC2 correct, send a positive acknowledgment (RR)
-                            C_ = (byte_C == C_INF(0)) ? C_RR(1) : C_RR(0);
-                        } 
-                        
-                        else {
-                            // BCC2 incorrect
-                            if ((C_Nr == 0 && byte_C == C_INF(1)) || (C_Nr == 1 && byte_C == C_INF(0))) {
-                                // received frame is the expected, send a positive acknowledgment (RR)
-                                C_ = (byte_C == C_INF(0)) ? C_RR(1) : C_RR(0);
-                            } else {
-                                // received frame is not the expected, send a negative acknowledgment (REJ)
-                                C_ = (byte_C == C_INF(0)) ? C_REJ(0) : C_REJ(1);
-                            }
-                        }
-                    
-                        // Simulate probability of error in BCC1 and BCC2
-                        // Use only for testing purposes
-                        if ((C_Nr == 0 && byte_C == C_INF(0)) || (C_Nr == 1 && byte_C == C_INF(1))) {
-                            if (rand() % 100 <= BCC1_ERROR - 1) {
-                                statistics.errorFrames++;
-                                break;
-                            }
-
-                            if (rand() % 100 <= BCC2_ERROR - 1) C_ = (byte_C == C_INF(0)) ? C_REJ(0) : C_REJ(1);
-
-                        }
-
-                        usleep(TPROPAGATION * 1000); // simulate propagation delay in ms
-
-                        if (sendCommandFrame(A_R, C_) != 1) {
-                            printf("[ERROR] Error sending response\n");
-                            return -1;
-                        }
-                        
-                        state = START_STATE;
-                        if (C_ == C_REJ(0) || C_ == C_REJ(1)) {
-                            statistics.errorFrames++;
-                            printf("[ALERT] Frame rejected, resending frame\n");
-                            break;
-                        }
-
-                        // update sequence number
-                        if ((C_Nr == 0 && byte_C == C_INF(0)) || (C_Nr == 1 && byte_C == C_INF(1))) {
-                            statistics.bytesRead += newSize + 6;
-                            statistics.nFrames++;
-
-                            nextNr();
-                            return newSize;
-                        }
-
-                        //printf("[ERROR] Discarding frame, duplicate\n");
-                    } else {
-                        packet[pos++] = byte;
-                    }
+        if (sendDelayedFrame(A_R, C_) != 1) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Error sending response\n");
+            return -1;
+        }
+        
+        // only the expected frame, acknowledged, delivers data
+        countReceived(&frame, packet, expected && C_ != C_REJ(0) && C_ != C_REJ(1));
+
+        if (C_ == C_REJ(0) || C_ == C_REJ(1)) {
+            statistics.errorFrames++;
+            metricAdd(framesRejected, 1);
+            logMessage(LOG_LEVEL_FRAME, "[ALERT] Frame rejected, resending frame\n");
+            continue;
+        }
 
-                    break;
+        // update sequence number
+        if (expected) {
+            statistics.bytesRead += frame.size + 6;
+            statistics.nFrames++;
 
-                default:
-                    state = START_STATE;
-                    
-            }
+            nextNr();
+            return frame.size;
         }
-    }
 
-    return -1;
+        //printf("[ERROR] Discarding frame, duplicate\n");
+    }
 }
 
 ////////////////////////////////////////////////
@@ -398,6 +453,10 @@ int llread(unsigned char *packet)
 ////////////////////////////////////////////////
 int llclose(int showStatistics)
 {
+    struct timeval closeTime;
+    gettimeofday(&closeTime, NULL);
+    traceEvent(TRACE_STATE, 0, 0, TRACE_SEQ, TRACE_CLOSING);
+
     switch (ROLE) {
 
         case LlTx:
@@ -414,9 +473,14 @@ int llclose(int showStatistics)
                 statistics.nFrames++;
                 statistics.bytesRead += 5;
 
-                if (sendCommandFrame(A_R, C_DISC) != 1) return -1;
+                // resend DISC until the transmitter's UA arrives. Everything was
+                // already delivered, so a missing UA is only worth a warning,
+                // and a transmitter that has closed its end is done
+                int result = receiveRetransmissionFrame(A_R, C_UA, A_R, C_DISC);
+                if (result == 1) statistics.bytesRead += 5;
+                else if (result == 0) logMessage(LOG_LEVEL_STATUS, "[STATUS] The transmitter closed the link before its UA arrived\n");
+                else logMessage(LOG_LEVEL_WARNING, "[Warning] No UA received for DISC\n");
                 statistics.nFrames++;
-                statistics.bytesRead += 5;
             }
             
             break;
@@ -427,10 +491,19 @@ int llclose(int showStatistics)
     }
 
     gettimeofday(&statistics.endTime, NULL);
+    statistics.closeTime = timeDiff(closeTime, statistics.endTime);
+
+    traceEvent(TRACE_STATE, 0, 0, TRACE_SEQ, TRACE_CLOSED);
+    metricSet(linkUp, FALSE);
+    if (traceEnabled && traceFlush() != 1) logMessage(LOG_LEVEL_WARNING, "[Warning] Unable to write the trace file\n");
 
     if (showStatistics) {
         showStatisticsTerminal();
     }
+    logFlush();
+
+    // responses still held back are sent before the port goes away
+    sendDueFrames(TRUE);
 
     return closeSerialPort();
 }
@@ -443,10 +516,35 @@ int llclose(int showStatistics)
 // Alarm handler
 void alarmHandler(int signal) 
 {
-    printf("Alarm #%d\n", alarmCount + 1);
+    // keepalives while suspended are not retransmissions
+    if (suspended) {
+        alarmEnabled = TRUE;
+        return;
+    }
+
+    alarmCount++;
+    logSignal(LOG_LEVEL_FRAME, "Alarm #", alarmCount);
+    alarmEnabled = TRUE;
+    statistics.retransmissions++;
+    metricAdd(timeouts, 1);
+    traceEvent(TRACE_TIMEOUT, 0, 0, TRACE_SEQ, alarmCount);
+}
+
+// Handshake alarm handler: while the interval is still growing the retries
+// are probes, counted apart from the timeouts
+void handshakeAlarmHandler(int signal)
+{
     alarmCount++;
     alarmEnabled = TRUE;
+    if (handshakeBackoff) {
+        statistics.handshakeProbes++;
+        return;
+    }
+
+    logSignal(LOG_LEVEL_FRAME, "Alarm #", alarmCount);
     statistics.retransmissions++;
+    metricAdd(timeouts, 1);
+    traceEvent(TRACE_TIMEOUT, 0, 0, TRACE_SEQ, alarmCount);
 }
 
 // Disable alarm
@@ -457,6 +555,54 @@ void alarmDisable()
     alarmCount = 0;
 }
 
+// Arm the alarm timer with millisecond resolution
+void setTimerMs(int ms)
+{
+    struct itimerval timer = {{0, 0}, {ms / 1000, (ms % 1000) * 1000}};
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+/**
+ * @brief Arm the handshake timer for the next retry.
+ *
+ * The interval is randomized by up to 1/HANDSHAKE_JITTER so that two ends
+ * retrying at the same time drift apart, and never exceeds TIMEOUT seconds.
+ *
+ * @param interval The nominal interval in milliseconds.
+ * @return int The next nominal interval (doubled, capped at TIMEOUT).
+ */
+int handshakeArm(int interval)
+{
+    int maxInterval = TIMEOUT * 1000;
+    if (interval > maxInterval) interval = maxInterval;
+
+    int spread = interval / HANDSHAKE_JITTER;
+    int delay = interval + (spread > 0 ? rand() % (2 * spread + 1) - spread : 0);
+    if (delay > maxInterval) delay = maxInterval;
+
+    setTimerMs(delay);
+
+    // retries below the full timeout don't count against nRetransmissions
+    handshakeBackoff = interval < maxInterval;
+
+    return interval * 2 < maxInterval ? interval * 2 : maxInterval;
+}
+
+/**
+ * @brief First interval of the handshake schedule for a frame of frameSize
+ * bytes: the time the frame and a 5-byte answer take on the line (10 bits a
+ * byte), the simulated propagation both ways, and HANDSHAKE_MARGIN_MS.
+ *
+ * @return int The interval in milliseconds.
+ */
+int handshakeFirstInterval(int frameSize)
+{
+    double ms = HANDSHAKE_MARGIN_MS + 2 * faults.propagationMs;
+    if (BAUDRATE > 0) ms += (frameSize + 5) * 10 * 1000.0 / BAUDRATE;
+
+    return (int) ms + 1;
+}
+
 // Switch Ns between 0 and 1
 void nextNs() 
 {
@@ -470,39 +616,68 @@ void nextNr()
 }
 
 /**
- * @brief Perform byte destuffing on the input buffer.
+ * @brief Build a frame whose information field is buf, with byte stuffing.
  *
- * This function processes the input buffer to remove escape sequences and
- * reconstruct the original data. It also extracts the BCC2 (Block Check Character 2)
- * from the buffer.
+ * Without data (bufSize 0) this is a plain supervision/unnumbered frame.
  *
- * @param buf The input buffer containing the stuffed data.
- * @param bufSize The size of the input buffer.
- * @param newSize Pointer to an integer where the new size of the buffer will be stored.
- * @param BCC2 Pointer to an unsigned char where the BCC2 will be stored.
- * @return int Returns 1 on success, -1 on error (e.g., null pointers), 1 on invalid buffer size.
+ * @param A The address field.
+ * @param C The control field.
+ * @param buf The information field, may be NULL when bufSize is 0.
+ * @param bufSize The size of the information field.
+ * @param frameSize Pointer to an integer where the frame size will be stored.
+ * @return unsigned char* The frame (to be freed by the caller), or NULL on error.
  */
-int destuffing(unsigned char *buf, int bufSize, int *newSize, unsigned char *BCC2) 
+unsigned char *buildFrame(unsigned char A, unsigned char C, const unsigned char *buf, int bufSize, int *frameSize)
 {
-    if (buf == NULL || newSize == NULL) return -1;
-    if (bufSize < 1) return 1;
+    if (frameSize == NULL || (buf == NULL && bufSize > 0)) return NULL;
 
-    unsigned char *r = buf, *w = buf;
+    // worst case: every byte and BCC2 stuffed
+    unsigned char *frame = poolAlloc(2 * bufSize + 7);
+    if (frame == NULL) return NULL;
 
-    while (r < buf + bufSize) {
-        if (*r != ESC) *w++ = *r++; // if not escape, copy byte
-        else {
-            // if ESC, check next and replace with FLAG/ESC
-            if (*(r + 1) == SUF_FLAG) *w++ = FLAG;  
-            else if (*(r + 1) == SUF_ESC) *w++ = ESC;
-            r += 2;
+    // Create frame header
+    frame[0] = FLAG;
+    frame[1] = A;
+    frame[2] = C;
+    frame[3] = A ^ C;
+
+    int pos = 4;
+    if (bufSize > 0) {
+        unsigned char BCC2 = 0;
+
+        // Data and stuffing
+        for (int i = 0; i < bufSize; i++) {
+            BCC2 ^= buf[i];
+
+            switch (buf[i]) {
+                case FLAG:
+                    frame[pos++] = ESC;
+                    frame[pos++] = SUF_FLAG;
+                    break;
+
+                case ESC:
+                    frame[pos++] = ESC;
+                    frame[pos++] = SUF_ESC;
+                    break;
+
+                default:
+                    frame[pos++] = buf[i];
+                    break;
+            }
         }
-    }
 
-    *BCC2 = *(w - 1);
-    *newSize = w - buf - 1;
+        // BCC2 is stuffed like the data, or a FLAG or ESC there would end
+        // the frame early or swallow the closing FLAG
+        if (BCC2 == FLAG || BCC2 == ESC) {
+            frame[pos++] = ESC;
+            frame[pos++] = BCC2 == FLAG ? SUF_FLAG : SUF_ESC;
+        }
+        else frame[pos++] = BCC2;
+    }
+    frame[pos++] = FLAG;
 
-    return 1;
+    *frameSize = pos;
+    return frame;
 }
 
 // Send Supervision Frame and Unnumbered Frame
@@ -511,139 +686,452 @@ int sendCommandFrame(unsigned char A, unsigned char C)
 {
     unsigned char buf_T[5] = {FLAG, A, C, A ^ C, FLAG};
 
-    return (writeBytesSerialPort(buf_T, 5) < 0) ? -1 : 1;
+    countSent(5, -1);
+    traceEvent(TRACE_SEND, A, C, TRACE_SEQ, 5);
+    return (timedWrite(buf_T, 5) < 0) ? -1 : 1;
 }
 
-// Receive Frame and check if it is the expected frame
-int receiveFrame(unsigned char A_EXPECTED, unsigned char C_EXPECTED) 
+/**
+ * @brief Read a fault setting from the environment.
+ *
+ * @param name The environment variable.
+ * @param value Where the setting is stored, left alone if the variable isn't set.
+ * @param max The largest valid value.
+ * @return int 1 on success, -1 if the variable isn't a number from 0 to max.
+ */
+static int faultFromEnv(const char *name, double *value, double max)
 {
-    LinkLayerState state = START_STATE;
+    const char *text = getenv(name);
+    if (text == NULL || *text == '\0') return 1;
 
-    while (state != STOP_STATE) 
-    {
-        int result;
-        unsigned char byte = 0;
-        
-        if((result = readByteSerialPort(&byte)) < 0) {
-            printf("[ERROR] Error reading response\n");
+    char *end;
+    double number = strtod(text, &end);
+    if (*end != '\0' || !(number >= 0 && number <= max)) {
+        logMessage(LOG_LEVEL_ERROR, "[ERROR] Initialization error: %s must be a number from 0 to %g\n", name, max);
+        return -1;
+    }
+
+    *value = number;
+    return 1;
+}
+
+/**
+ * @brief Set the simulated faults from the connection parameters and the
+ * environment, and seed their generator. The seed in use is logged, so a run
+ * can be repeated with LL_SEED.
+ *
+ * @param parameters The connection parameters.
+ * @return int 1 on success, -1 if a setting is invalid.
+ */
+static int configureFaults(const LinkLayer *parameters)
+{
+    if (parameters->propagationMs > 0) faults.propagationMs = parameters->propagationMs;
+    if (parameters->bcc1Error > 0) faults.bcc1Error = parameters->bcc1Error;
+    if (parameters->bcc2Error > 0) faults.bcc2Error = parameters->bcc2Error;
+    faults.seed = parameters->seed;
+
+    if (faultFromEnv("LL_TPROPAGATION", &faults.propagationMs, 60000) != 1 ||
+        faultFromEnv("LL_BCC1_ERROR", &faults.bcc1Error, 100) != 1 ||
+        faultFromEnv("LL_BCC2_ERROR", &faults.bcc2Error, 100) != 1) return -1;
+
+    const char *seed = getenv("LL_SEED");
+    if (seed != NULL && *seed != '\0') {
+        char *end;
+        faults.seed = strtoull(seed, &end, 0);
+        if (*end != '\0') {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Initialization error: LL_SEED must be a number\n");
             return -1;
         }
+    }
+    if (faults.seed == 0) faults.seed = monotonicNs() ^ ((uint64_t) getpid() << 32);
+    prngSeed(&faultRng, faults.seed);
 
-        else if(result > 0){
-            switch (state) {
+    if (faults.propagationMs > 0 || faults.bcc1Error > 0 || faults.bcc2Error > 0) {
+        logMessage(LOG_LEVEL_STATUS, "[INFO] Simulating %g ms of propagation, %g%% BCC1 and %g%% BCC2 errors (seed %llu)\n",
+                   faults.propagationMs, faults.bcc1Error, faults.bcc2Error, (unsigned long long) faults.seed);
+    }
 
-                case START_STATE:
-                    if (byte == FLAG) state = FLAG_RCV;
-                    break;
+    return 1;
+}
 
-                case FLAG_RCV:
-                    if (byte == A_EXPECTED) state = A_RCV;
-                    else if (byte != FLAG) state = START_STATE;
-                    break;
+/**
+ * @brief Send a response after the simulated propagation delay. It is queued
+ * and sent by nextFrame once a round trip has passed, so the receive loop
+ * keeps running meanwhile.
+ *
+ * @return int 1 on success, -1 on error.
+ */
+static int sendDelayedFrame(unsigned char A, unsigned char C)
+{
+    if (faults.propagationMs <= 0) return sendCommandFrame(A, C);
 
-                case A_RCV:
-                    if (byte == C_EXPECTED) state = C_RCV;
-                    else if (byte == FLAG) state = FLAG_RCV;
-                    else state = START_STATE;
-                    break;
+    // a full queue lets its oldest response go early
+    if (delayedCount == DELAYED_FRAMES && sendOldestDelayedFrame() != 1) return -1;
 
-                case C_RCV:
-                    if (byte == FLAG) state = FLAG_RCV;
-                    else if ((A_EXPECTED ^ C_EXPECTED) == byte) state = BCC_OK;
-                    else state = START_STATE;
-                    break;
+    DelayedFrame *delayed = &delayedFrames[(delayedHead + delayedCount) % DELAYED_FRAMES];
+    delayed->due = monotonicNs() + (uint64_t) (2 * faults.propagationMs * 1e6);
+    delayed->A = A;
+    delayed->C = C;
+    delayedCount++;
 
-                case BCC_OK:
-                    if (byte == FLAG) state = STOP_STATE;
-                    else state = START_STATE;
-                    break;
+    return 1;
+}
 
-                default:
-                    state = START_STATE;
+// Send the oldest queued response
+// Returns 1 on success, -1 on error
+static int sendOldestDelayedFrame()
+{
+    DelayedFrame *delayed = &delayedFrames[delayedHead];
+    delayedHead = (delayedHead + 1) % DELAYED_FRAMES;
+    delayedCount--;
+
+    return sendCommandFrame(delayed->A, delayed->C);
+}
+
+// Send the queued responses whose delay is over, or all of them
+// Returns 1 on success, -1 on error
+static int sendDueFrames(int all)
+{
+    if (delayedCount == 0) return 1;
+
+    uint64_t now = monotonicNs();
+    while (delayedCount > 0 && (all || delayedFrames[delayedHead].due <= now)) {
+        if (sendOldestDelayedFrame() != 1) return -1;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Count the first send of a frame in the link byte statistics.
+ *
+ * @param frameSize The size of the stuffed frame.
+ * @param infoSize The size of its information field, -1 for S and U frames.
+ */
+static void countSent(int frameSize, int infoSize)
+{
+    metricAdd(framesSent, 1);
+
+    if (infoSize < 0) {
+        statistics.supervisionBytes += frameSize;
+        metricAdd(supervisionBytes, frameSize);
+        return;
+    }
+
+    statistics.headerBytes += 6;
+    statistics.stuffingBytes += frameSize - infoSize - 6;
+    metricAdd(headerBytes, 6);
+    metricAdd(stuffingBytes, frameSize - infoSize - 6);
+}
+
+// Count a frame sent again in the link byte statistics
+static void countResent(int frameSize)
+{
+    statistics.retransmittedBytes += frameSize;
+    metricAdd(framesSent, 1);
+    metricAdd(framesResent, 1);
+    metricAdd(retransmittedBytes, frameSize);
+}
+
+// Count a handshake probe (a SET or DISC sent again before the retry
+// interval reached the full timeout) as supervision, not as a retransmission
+static void countProbe(int frameSize)
+{
+    statistics.supervisionBytes += frameSize;
+    metricAdd(framesSent, 1);
+    metricAdd(supervisionBytes, frameSize);
+}
+
+/**
+ * @brief Count a received I-frame in the link byte statistics. S and U frames
+ * are counted by nextFrame.
+ *
+ * @param frame The received frame.
+ * @param packet Its information field.
+ * @param delivered Whether its data was taken, rather than being a duplicate
+ * or a rejected copy.
+ */
+static void countReceived(const Frame *frame, const unsigned char *packet, int delivered)
+{
+    if (!delivered) {
+        statistics.retransmittedBytes += frame->size + 6 + frame->escapes;
+        metricAdd(retransmittedBytes, frame->size + 6 + frame->escapes);
+        return;
+    }
+
+    statistics.headerBytes += 6;
+    statistics.stuffingBytes += frame->escapes;
+    metricAdd(headerBytes, 6);
+    metricAdd(stuffingBytes, frame->escapes);
+    countDelivered(packet, frame->size);
+}
 
+/**
+ * @brief Count a packet delivered to the peer (transmitter) or taken from it
+ * (receiver), printing the live rate every RATE_PRINT_S seconds. Only its
+ * file bytes are payload; its header is counted with the frame header.
+ *
+ * @param packet The information field.
+ * @param size The size of the information field.
+ */
+static void countDelivered(const unsigned char *packet, int size)
+{
+    uint64_t now = monotonicNs();
+    uint64_t second = now / 1000000000ULL;
+    int bytes = PACKET_PAYLOAD_SIZE(packet, size);
+
+    statistics.headerBytes += size - bytes;
+    metricAdd(headerBytes, size - bytes);
+    statistics.payloadBytes += bytes;
+    rateRecord(&statistics.rate, bytes, now);
+    metricAdd(payloadBytes, bytes);
+    metricSet(throughput, (uint64_t) rateBytesPerSecond(&statistics.rate, now));
+
+    if (statistics.rate.lastPrint == 0) statistics.rate.lastPrint = second;
+    else if (second >= statistics.rate.lastPrint + RATE_PRINT_S) {
+        statistics.rate.lastPrint = second;
+        logMessage(LOG_LEVEL_STATUS, "[STATUS] Live rate: %.0f bytes/s, %llu bytes so far\n",
+               rateBytesPerSecond(&statistics.rate, now),
+               (unsigned long long) statistics.payloadBytes);
+    }
+}
+
+/**
+ * @brief Write to the serial port, recording how long the call took.
+ *
+ * @return int The result of writeBytesSerialPort.
+ */
+static int timedWrite(const unsigned char *bytes, int numBytes)
+{
+    uint64_t start = monotonicNs();
+    int result = writeBytesSerialPort(bytes, numBytes);
+    histogramRecord(&statistics.ioTime, monotonicNs() - start);
+
+    return result;
+}
+
+/**
+ * @brief Parse the next frame out of the received chunks.
+ *
+ * Bytes are read from the serial port a chunk at a time, and a new chunk is
+ * read only once the parser has used up the previous one.
+ *
+ * @param frame Where the parsed frame is stored.
+ * @param buffer Where its information field is written.
+ * @param capacity The size of buffer.
+ * @return int 1 when a frame was parsed, 0 if no byte was received, -1 on error.
+ */
+int nextFrame(Frame *frame, unsigned char *buffer, int capacity)
+{
+    // time spent parsing the current frame, which may span several calls
+    static uint64_t decodeNs = 0;
+
+    parserSetBuffer(&parser, buffer, capacity);
+
+    while (TRUE) {
+        if (rxChunkPos == rxChunkSize) {
+            if (sendDueFrames(FALSE) != 1) return -1;
+
+            uint64_t start = monotonicNs();
+            int result = readBytesSerialPort(rxChunk, RX_CHUNK_SIZE);
+            if (result < 0) return errno == EINTR ? 0 : -1;
+            if (result == 0) {
+                if (idleSince == 0) idleSince = start;
+                return 0;
+            }
+            histogramRecord(&statistics.ioTime, monotonicNs() - start);
+
+            if (idleSince != 0) {
+                statistics.idleNs += start - idleSince;
+                idleSince = 0;
             }
+
+            rxChunkPos = 0;
+            rxChunkSize = result;
+        }
+
+        int consumed = 0;
+        uint64_t start = monotonicNs();
+        int found = parserFeed(&parser, rxChunk + rxChunkPos, rxChunkSize - rxChunkPos, &consumed, frame);
+        decodeNs += monotonicNs() - start;
+        rxChunkPos += consumed;
+
+        statistics.errorFrames += parser.errors;
+        if (parser.errors > 0) {
+            traceEvent(TRACE_DROP, 0, 0, TRACE_SEQ, parser.errors);
+            metricAdd(framesDropped, parser.errors);
+        }
+        parser.errors = 0;
+
+        if (found) {
+            histogramRecord(&statistics.decodeTime, decodeNs);
+            decodeNs = 0;
+            metricAdd(framesReceived, 1);
+            if (frame->size < 0) {
+                statistics.supervisionBytes += 5;
+                metricAdd(supervisionBytes, 5);
+            }
+            traceEvent(frame->bcc2Ok ? TRACE_RECEIVE : TRACE_BAD_BCC2, frame->A, frame->C, TRACE_SEQ, frame->size);
+            return 1;
         }
     }
+}
 
-    return 1;
+/**
+ * @brief Answer a frame that arrived where it wasn't expected.
+ *
+ * A repeated I-frame means the peer missed our RR, so it is acknowledged again
+ * and the peer's llwrite can finish, even while we are sending ourselves. A
+ * repeated SET gets UA and a keepalive gets RR for the frame we expect next.
+ * A new I-frame is left unanswered: the peer resends it until llread takes it.
+ *
+ * @param frame The received frame.
+ * @return int 1 if the frame was answered, 0 if it was ignored, -1 on error.
+ */
+int answerFrame(const Frame *frame)
+{
+    if (frame->size >= 0) countReceived(frame, NULL, FALSE);
+    if (frame->A != A_T) return 0;
+
+    if (frame->C == C_SET) return sendCommandFrame(A_T, C_UA);
+    if (frame->C == C_KEEPALIVE) return sendCommandFrame(A_R, C_RR(C_Nr));
+
+    if (frame->size >= 0 && (frame->C == C_INF(0) || frame->C == C_INF(1)) && frame->C != C_INF(C_Nr)) {
+        return sendCommandFrame(A_R, C_RR(C_Nr));
+    }
+
+    return 0;
 }
 
-// Receive Frame with retransmission and check if it is the expected frame
+// Receive Frame and check if it is the expected frame
 // Returns 1 on success, -1 on error
-int receiveRetransmissionFrame(unsigned char A_EXPECTED, unsigned char C_EXPECTED, unsigned char A_SEND, unsigned char C_SEND) 
+int receiveFrame(unsigned char A_EXPECTED, unsigned char C_EXPECTED) 
 {
-    LinkLayerState state = START_STATE;
-
-    (void)signal(SIGALRM, alarmHandler);
+    while (TRUE) 
+    {
+        Frame frame;
+        int result = nextFrame(&frame, frameBuffer, sizeof(frameBuffer));
 
-    if (sendCommandFrame(A_SEND, C_SEND) != 1) return -1;
+        if (result < 0) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Error reading response\n");
+            return -1;
+        }
+        if (result == 0) continue;
 
-    alarm(TIMEOUT); 
+        if (frame.A == A_EXPECTED && frame.C == C_EXPECTED && frame.size < 0) return 1;
+        if (answerFrame(&frame) < 0) return -1;
+    }
+}
 
-    while (state != STOP_STATE && alarmCount <= RETRANSMISSIONS) 
+/**
+ * @brief Receive a SET frame, with or without a piggybacked packet.
+ *
+ * An extended SET carries one packet in an I-frame style information field.
+ * It is stored in earlyData for the first llread. A SET whose BCC2 fails is
+ * ignored, so the transmitter sends it again.
+ *
+ * @return int 1 on success, -1 on error.
+ */
+int receiveSetFrame()
+{
+    while (TRUE)
     {
-        int result;
-        unsigned char byte = 0;
-        
-        if((result = readByteSerialPort(&byte)) < 0) {
-            printf("[ERROR] Error reading UA frame\n");
+        Frame frame;
+        int result = nextFrame(&frame, earlyData, sizeof(earlyData));
+
+        if (result < 0) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Error reading response\n");
             return -1;
         }
+        if (result == 0 || frame.A != A_T || frame.C != C_SET) continue;
 
-        else if(result > 0){
-            switch (state) {
+        if (frame.size < 0) {
+            earlyDataSize = 0;
+            return 1;
+        }
 
-                case START_STATE:
-                    if (byte == FLAG) state = FLAG_RCV;
-                    break;
+        if (frame.bcc2Ok && frame.size > 0) {
+            earlyDataSize = frame.size;
+            statistics.bytesRead += frame.size + 1;
+            countReceived(&frame, earlyData, TRUE);
+            return 1;
+        }
 
-                case FLAG_RCV:
-                    if (byte == A_EXPECTED) state = A_RCV;
-                    else if (byte != FLAG) state = START_STATE;
-                    break;
+        statistics.errorFrames++;
+        countReceived(&frame, earlyData, FALSE);
+    }
+}
 
-                case A_RCV:
-                    if (byte == C_EXPECTED) state = C_RCV;
-                    else if (byte == FLAG) state = FLAG_RCV;
-                    else state = START_STATE;
-                    break;
+// Receive Frame with retransmission and check if it is the expected frame
+// Returns 1 on success, -1 on error
+int receiveRetransmissionFrame(unsigned char A_EXPECTED, unsigned char C_EXPECTED, unsigned char A_SEND, unsigned char C_SEND) 
+{
+    unsigned char frame[5] = {FLAG, A_SEND, C_SEND, A_SEND ^ C_SEND, FLAG};
 
-                case C_RCV:
-                    if (byte == FLAG) state = FLAG_RCV;
-                    else if ((C_EXPECTED ^ A_EXPECTED) == byte) state = BCC_OK;
-                    else state = START_STATE;
-                    break;
+    countSent(sizeof(frame), -1);
+    return retransmitFrame(frame, sizeof(frame), A_EXPECTED, C_EXPECTED);
+}
 
-                case BCC_OK:
-                    if (byte == FLAG) state = STOP_STATE;
-                    else state = START_STATE;
-                    break;
+// Send a frame until the expected answer arrives, on the handshake schedule.
+// Once the peer has closed its end, the bytes it sent before are still read.
+// Returns 1 on success, 0 if the peer closed without answering, -1 on error
+int retransmitFrame(const unsigned char *frame, int frameSize, unsigned char A_EXPECTED, unsigned char C_EXPECTED)
+{
+    (void)signal(SIGALRM, handshakeAlarmHandler);
 
-                default:
-                    state = START_STATE;
+    traceEvent(TRACE_SEND, frame[1], frame[2], TRACE_SEQ, frameSize);
+    int written = timedWrite(frame, frameSize);
+    if (written < 0 && written != TRANSPORT_PEER_CLOSED) return -1;
+    int peerClosed = written == TRANSPORT_PEER_CLOSED;
 
+    int interval = handshakeArm(handshakeFirstInterval(frameSize));
+
+    while (alarmCount <= RETRANSMISSIONS) 
+    {
+        Frame response;
+        int result = nextFrame(&response, frameBuffer, sizeof(frameBuffer));
+
+        if (result < 0) {
+            logMessage(LOG_LEVEL_ERROR, "[ERROR] Error reading UA frame\n");
+            break;
+        }
+
+        if (result > 0) {
+            if (response.A == A_EXPECTED && response.C == C_EXPECTED && response.size < 0) {
+                alarmDisable();
+                return 1;
             }
+
+            if (answerFrame(&response) < 0) break;
         }
 
-        if (state == STOP_STATE) {
+        if (peerClosed && result == 0) {
             alarmDisable();
-            return 1;
+            return 0;
         }
         
-        else if (alarmEnabled) {
+        if (alarmEnabled && !peerClosed) {
             alarmEnabled = FALSE;
+            int probe = handshakeBackoff;
+            if (probe) alarmCount = 0;
 
             if (alarmCount <= RETRANSMISSIONS) {
 
-                if (sendCommandFrame(A_SEND, C_SEND) != 1) {
-                    printf("[ERROR] Error writing send command\n");
-                    return -1;
+                written = timedWrite(frame, frameSize);
+                if (written == TRANSPORT_PEER_CLOSED) {
+                    peerClosed = TRUE;
+                    continue;
+                }
+                if (written < 0) {
+                    logMessage(LOG_LEVEL_ERROR, "[ERROR] Error writing send command\n");
+                    break;
                 }
+                if (probe) countProbe(frameSize);
+                else countResent(frameSize);
+                traceEvent(probe ? TRACE_SEND : TRACE_RESEND, frame[1], frame[2], TRACE_SEQ, frameSize);
 
-                alarm(TIMEOUT);
+                interval = handshakeArm(interval);
             }
-            
-            state = START_STATE;
         }
     }
 
@@ -652,24 +1140,68 @@ int receiveRetransmissionFrame(unsigned char A_EXPECTED, unsigned char C_EXPECTE
     return -1;
 }
 
+/**
+ * @brief Print the link bytes by cause, each with its share of the total, and
+ * the time spent idle.
+ */
+void showLinkBytes()
+{
+    const char *names[] = {"Payload", "Header", "Stuffing", "Retransmitted", "Supervision"};
+    uint64_t bytes[] = {statistics.payloadBytes, statistics.headerBytes, statistics.stuffingBytes,
+                        statistics.retransmittedBytes, statistics.supervisionBytes};
+    uint64_t total = total_link_bytes(&statistics);
+    double seconds = timeDiff(statistics.startTime, statistics.endTime);
+
+    printf("%31s  %12s %7s\n", "Link bytes", "bytes", "share");
+    for (int i = 0; i < 5; i++) {
+        printf("%31s: %12llu %6.2f%%\n", names[i], (unsigned long long) bytes[i],
+               total > 0 ? bytes[i] * 100.0 / total : 0);
+    }
+    printf("%31s: %12llu\n", "Total", (unsigned long long) total);
+    printf("                      Idle time: %f seconds (%.1f%% of the transfer)\n", statistics.idleNs / 1e9,
+           seconds > 0 ? statistics.idleNs / 1e9 * 100 / seconds : 0);
+}
+
 void showStatisticsTerminal() {
+    logFlush();
+
     const char *role_str = (ROLE == LlTx) ? "TRANSMITTER" : "RECEIVER";
     printf("\n\t======= [%s STATISTICS] =======\n\n", role_str);
     if (ROLE == LlTx) { // Transmitter
-        printf("               Good frames sent: %u frames\n", statistics.nFrames);
-        printf("          Total retransmissions: %u\n", statistics.retransmissions);
+        printf("               Good frames sent: %llu frames\n", (unsigned long long) statistics.nFrames);
+        printf("          Total retransmissions: %llu\n", (unsigned long long) statistics.retransmissions);
+        printf("               Handshake probes: %llu\n", (unsigned long long) statistics.handshakeProbes);
         printf("              Image Upload time: %f seconds\n", timeDiff(statistics.startTime, statistics.endTime));
+        printf("                Time to connect: %f ms\n", statistics.connectTime * 1000);
+        printf("                  Time to close: %f ms\n", statistics.closeTime * 1000);
         printf("\n");
-        printf("              Actual efficiency: %f\n", actual_efficiency(statistics, BAUDRATE));
+        printf("                        Goodput: %f bits/s\n", received_bit_rate(&statistics));
+        printf("              Actual efficiency: %f\n", actual_efficiency(&statistics, BAUDRATE));
         printf("             Optimal efficiency: %f\n", optimal_efficiency(BAUDRATE, MAX_PAYLOAD_SIZE));
     } else {        // Receiver
-        printf("           Good frames received: %u frames\n", statistics.nFrames);
-        printf("           Bad frames discarded: %u frames\n", statistics.errorFrames);
-        printf("     Received bytes (destuffed): %u bytes\n", statistics.bytesRead);
+        printf("           Good frames received: %llu frames\n", (unsigned long long) statistics.nFrames);
+        printf("           Bad frames discarded: %llu frames\n", (unsigned long long) statistics.errorFrames);
+        printf("               Handshake probes: %llu\n", (unsigned long long) statistics.handshakeProbes);
+        printf("     Received bytes (destuffed): %llu bytes\n", (unsigned long long) statistics.bytesRead);
         printf("            Image Download time: %f seconds\n", timeDiff(statistics.startTime, statistics.endTime));
+        printf("                Time to connect: %f ms\n", statistics.connectTime * 1000);
+        printf("                  Time to close: %f ms\n", statistics.closeTime * 1000);
         printf("\n");
-        printf("              Received bit rate: %f bits/s\n", received_bit_rate(statistics));
+        printf("              Received bit rate: %f bits/s\n", received_bit_rate(&statistics));
     }
+    printf("\n");
+    showLinkBytes();
+    printf("\n");
+    printf("        Packet pool hits/misses: %llu / %llu\n",
+           (unsigned long long) poolStatistics.hits, (unsigned long long) poolStatistics.misses);
+    printf("           Packet pool peak use: %d of %d slots (%d bytes each)\n",
+           poolStatistics.peak, POOL_SLOTS, (int) POOL_SLOT_SIZE);
+    printf("\n");
+    printf("%31s  %8s %10s %10s %10s %10s %10s\n", "Latency (us)", "count", "mean", "p50", "p90", "p99", "max");
+    histogramPrint("Time to ACK", &statistics.ackTime);
+    histogramPrint("Frame encode", &statistics.encodeTime);
+    histogramPrint("Frame decode", &statistics.decodeTime);
+    histogramPrint("Serial I/O", &statistics.ioTime);
     printf("\n\t=====================================");
     if (ROLE == LlTx) printf("===");
     printf("\n\n");
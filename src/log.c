@@ -0,0 +1,254 @@
+// Logger implementation
+
+#include "log.h"
+#include "link_layer.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int logLevel = LOG_LEVEL_FRAME;
+
+static const char *levelNames[] = {"off", "error", "warning", "status", "frame"};
+
+int logSetLevel(const char *name)
+{
+    for (int level = LOG_LEVEL_OFF; level <= LOG_LEVEL_FRAME; level++) {
+        if (strcmp(name, levelNames[level]) == 0) {
+            logLevel = level;
+            return 1;
+        }
+    }
+
+    return -1;
+}
+
+#ifdef LL_NO_HEAP
+
+// Heap-free builds log synchronously: there is no ring and no writer thread,
+// and a message goes out in one write, so stdio never allocates a buffer.
+
+int logStart()
+{
+    return 1;
+}
+
+void logFlush()
+{
+}
+
+void logWrite(const char *format, ...)
+{
+    char line[LOG_RECORD_SIZE];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (length < 0) return;
+
+    // a cut message still ends its line
+    if (length >= LOG_RECORD_SIZE) {
+        line[LOG_RECORD_SIZE - 2] = '\n';
+        length = LOG_RECORD_SIZE - 1;
+    }
+
+    ssize_t written = write(STDOUT_FILENO, line, length);
+    (void) written;
+}
+
+#else
+
+typedef struct {
+    atomic_int ready; // set once the text is complete
+    char text[LOG_RECORD_SIZE];
+} LogRecord;
+
+static LogRecord records[LOG_RECORDS];
+static atomic_uint_fast64_t head = 0; // records claimed
+static atomic_uint_fast64_t tail = 0; // records written
+static atomic_uint_fast64_t dropped = 0;
+static sem_t pending;
+static sem_t drained;              // posted after each drain while a flush waits
+static atomic_int flushing = 0;    // threads waiting in logFlush
+static pthread_t writer;
+static atomic_int running = FALSE;
+static atomic_int stopping = FALSE;
+
+/**
+ * @brief Claim the next free record.
+ *
+ * @return LogRecord* The record, or NULL if the ring is full.
+ */
+static LogRecord *claim()
+{
+    uint_fast64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+
+    do {
+        if (h - atomic_load_explicit(&tail, memory_order_acquire) >= LOG_RECORDS) {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return NULL;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&head, &h, h + 1, memory_order_acq_rel, memory_order_relaxed));
+
+    return &records[h & (LOG_RECORDS - 1)];
+}
+
+// Hand a complete record to the writer
+static void publish(LogRecord *record)
+{
+    atomic_store_explicit(&record->ready, TRUE, memory_order_release);
+    sem_post(&pending);
+}
+
+// Write the records that are ready, in order. Only the writer thread (or the
+// caller, before it starts) moves tail.
+static void drain()
+{
+    while (TRUE) {
+        uint_fast64_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+        LogRecord *record = &records[t & (LOG_RECORDS - 1)];
+        if (t == atomic_load_explicit(&head, memory_order_acquire) ||
+            !atomic_load_explicit(&record->ready, memory_order_acquire)) break;
+
+        fputs(record->text, stdout);
+        atomic_store_explicit(&record->ready, FALSE, memory_order_relaxed);
+        atomic_store_explicit(&tail, t + 1, memory_order_release);
+    }
+
+    uint_fast64_t lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (lost > 0) printf("[Warning] %llu log messages dropped\n", (unsigned long long) lost);
+
+    fflush(stdout);
+}
+
+static void *writerThread(void *arg)
+{
+    while (!atomic_load(&stopping) || atomic_load(&tail) != atomic_load(&head)) {
+        while (sem_wait(&pending) == -1) {}
+        drain();
+        if (atomic_load(&flushing) > 0) sem_post(&drained);
+    }
+
+    return NULL;
+}
+
+static void logStop()
+{
+    if (!atomic_load(&running)) return;
+
+    atomic_store(&stopping, TRUE);
+    sem_post(&pending);
+    pthread_join(writer, NULL);
+    atomic_store(&running, FALSE);
+}
+
+int logStart()
+{
+    if (atomic_load(&running)) return 1;
+
+    // the writer blocks every signal, so SIGALRM and the others still
+    // interrupt the thread that runs the link
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    int result = sem_init(&pending, 0, 0) == -1 || sem_init(&drained, 0, 0) == -1 ? -1
+                 : pthread_create(&writer, NULL, writerThread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (result != 0) {
+        printf("[Warning] Unable to start the log writer, logging synchronously\n");
+        return -1;
+    }
+
+    static int registered = FALSE;
+    if (!registered) atexit(logStop);
+    registered = TRUE;
+
+    atomic_store(&stopping, FALSE);
+    atomic_store(&running, TRUE);
+    return 1;
+}
+
+void logFlush()
+{
+    if (!atomic_load(&running)) return;
+
+    // every record is published with a post, so the writer drains it
+    // after that; once flushing is set, each drain wakes this thread
+    uint_fast64_t target = atomic_load(&head);
+    atomic_fetch_add(&flushing, 1);
+    while (atomic_load(&tail) < target) {
+        while (sem_wait(&drained) == -1) {}
+    }
+    atomic_fetch_sub(&flushing, 1);
+}
+
+void logWrite(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    if (!atomic_load_explicit(&running, memory_order_relaxed)) {
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
+
+    LogRecord *record = claim();
+    if (record != NULL) {
+        // a cut message still ends its line
+        if (vsnprintf(record->text, LOG_RECORD_SIZE, format, args) >= LOG_RECORD_SIZE) {
+            record->text[LOG_RECORD_SIZE - 2] = '\n';
+        }
+        publish(record);
+    }
+
+    va_end(args);
+}
+
+#endif // LL_NO_HEAP
+
+void logSignal(int level, const char *text, long value)
+{
+    if (level > logLevel) return;
+
+    // format by hand: snprintf isn't async-signal-safe
+    char digits[24];
+    int n = 0;
+    unsigned long v = value < 0 ? -(unsigned long) value : (unsigned long) value;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+    if (value < 0) digits[n++] = '-';
+
+    char line[LOG_RECORD_SIZE];
+    size_t len = strnlen(text, LOG_RECORD_SIZE - sizeof(digits) - 2);
+    memcpy(line, text, len);
+    while (n > 0) line[len++] = digits[--n];
+    line[len++] = '\n';
+    line[len] = '\0';
+
+#ifndef LL_NO_HEAP
+    if (atomic_load_explicit(&running, memory_order_relaxed)) {
+        LogRecord *record = claim();
+        if (record != NULL) {
+            memcpy(record->text, line, len + 1);
+            publish(record);
+        }
+        return;
+    }
+#endif
+
+    ssize_t written = write(STDOUT_FILENO, line, len);
+    (void) written;
+}
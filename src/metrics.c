@@ -0,0 +1,291 @@
+// Live metrics implementation
+
+#include "metrics.h"
+#include "histogram.h"
+#include "link_layer.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// How long a client gets to send its request before the bare text is sent
+#define METRICS_REQUEST_MS 100
+
+#define METRICS_TEXT_SIZE 8192
+
+Metrics metrics;
+
+static const uint64_t rttBoundsUs[METRICS_RTT_BUCKETS - 1] = METRICS_RTT_BOUNDS_US;
+
+#ifndef LL_NO_HEAP
+static int listenFd = -1;
+static char socketPath[108];
+static char filePath[256];
+static pthread_t server;
+#endif
+
+void metricsRecordRtt(uint64_t ns)
+{
+    int bucket = 0;
+    while (bucket < METRICS_RTT_BUCKETS - 1 && ns > rttBoundsUs[bucket] * 1000) bucket++;
+
+    metricAdd(rttBuckets[bucket], 1);
+    metricAdd(rttSumNs, ns);
+    metricSet(lastRttNs, ns);
+}
+
+#ifdef LL_NO_HEAP
+
+// Heap-free builds keep the counters, but leave out the server thread and the
+// text it formats
+int metricsStart(const char *socketName, const char *fileName)
+{
+    if (socketName == NULL && fileName == NULL) return 1;
+
+    printf("[ERROR] Metrics error: Live metrics are not available in heap-free builds\n");
+    return -1;
+}
+
+#else
+
+typedef struct {
+    char *text;
+    size_t size;
+    size_t length;
+} Text;
+
+static void append(Text *t, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(Text *t, const char *format, ...)
+{
+    if (t->length >= t->size) return;
+
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(t->text + t->length, t->size - t->length, format, args);
+    va_end(args);
+
+    if (n > 0) t->length += n;
+    if (t->length > t->size) t->length = t->size;
+}
+
+static void appendMetric(Text *t, const char *name, const char *type, const char *help)
+{
+    append(t, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static unsigned long long load(atomic_uint_fast64_t *value)
+{
+    return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+/**
+ * @brief Write every metric in the Prometheus text format.
+ *
+ * @return size_t The length of the text.
+ */
+static size_t formatMetrics(char *text, size_t size)
+{
+    Text t = {text, size, 0};
+
+    appendMetric(&t, "ll_link_info", "gauge", "Role of this end of the link.");
+    append(&t, "ll_link_info{role=\"%s\"} 1\n", atomic_load(&metrics.role) == LlTx ? "tx" : "rx");
+
+    struct {
+        const char *name;
+        const char *help;
+        atomic_uint_fast64_t *value;
+    } counters[] = {
+        {"ll_frames_sent_total", "Frames written, resends included.", &metrics.framesSent},
+        {"ll_frames_resent_total", "Frames written again after a timeout or REJ.", &metrics.framesResent},
+        {"ll_frames_received_total", "Frames parsed, with a good BCC2 or not.", &metrics.framesReceived},
+        {"ll_frames_rejected_total", "REJ frames sent (receiver) or received (transmitter).", &metrics.framesRejected},
+        {"ll_frames_dropped_total", "Frames dropped by the parser (bad BCC1, bad escape, overflow).", &metrics.framesDropped},
+        {"ll_timeouts_total", "Retransmission timer expiries.", &metrics.timeouts},
+    };
+
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        appendMetric(&t, counters[i].name, "counter", counters[i].help);
+        append(&t, "%s %llu\n", counters[i].name, load(counters[i].value));
+    }
+
+    appendMetric(&t, "ll_bytes_total", "counter", "Link bytes by cause.");
+    append(&t, "ll_bytes_total{cause=\"payload\"} %llu\n", load(&metrics.payloadBytes));
+    append(&t, "ll_bytes_total{cause=\"header\"} %llu\n", load(&metrics.headerBytes));
+    append(&t, "ll_bytes_total{cause=\"stuffing\"} %llu\n", load(&metrics.stuffingBytes));
+    append(&t, "ll_bytes_total{cause=\"retransmitted\"} %llu\n", load(&metrics.retransmittedBytes));
+    append(&t, "ll_bytes_total{cause=\"supervision\"} %llu\n", load(&metrics.supervisionBytes));
+
+    appendMetric(&t, "ll_rtt_seconds", "histogram", "Round trip of I-frames acknowledged after a single send.");
+    unsigned long long cumulative = 0;
+    for (int i = 0; i < METRICS_RTT_BUCKETS; i++) {
+        cumulative += load(&metrics.rttBuckets[i]);
+        if (i < METRICS_RTT_BUCKETS - 1) append(&t, "ll_rtt_seconds_bucket{le=\"%g\"} %llu\n", rttBoundsUs[i] / 1e6, cumulative);
+        else append(&t, "ll_rtt_seconds_bucket{le=\"+Inf\"} %llu\n", cumulative);
+    }
+    append(&t, "ll_rtt_seconds_sum %.9f\n", load(&metrics.rttSumNs) / 1e9);
+    append(&t, "ll_rtt_seconds_count %llu\n", cumulative);
+
+    appendMetric(&t, "ll_rtt_last_seconds", "gauge", "Latest round trip sample.");
+    append(&t, "ll_rtt_last_seconds %.9f\n", load(&metrics.lastRttNs) / 1e9);
+    appendMetric(&t, "ll_rto_seconds", "gauge", "Retransmission timeout.");
+    append(&t, "ll_rto_seconds %.3f\n", load(&metrics.rtoMs) / 1e3);
+    appendMetric(&t, "ll_window_frames", "gauge", "I-frames sent and not acknowledged yet.");
+    append(&t, "ll_window_frames %d\n", atomic_load(&metrics.window));
+    appendMetric(&t, "ll_throughput_bytes_per_second", "gauge", "Payload rate over the last seconds.");
+    append(&t, "ll_throughput_bytes_per_second %llu\n", load(&metrics.throughput));
+    appendMetric(&t, "ll_link_up", "gauge", "Whether the link is established.");
+    append(&t, "ll_link_up %d\n", atomic_load(&metrics.linkUp));
+    appendMetric(&t, "ll_link_suspended", "gauge", "Whether the session is suspended on a silent link.");
+    append(&t, "ll_link_suspended %d\n", atomic_load(&metrics.suspended));
+
+    return t.length;
+}
+
+static int sendAll(int fd, const char *text, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = send(fd, text, length, MSG_NOSIGNAL);
+        if (n <= 0) return -1;
+        text += n;
+        length -= n;
+    }
+
+    return 1;
+}
+
+// Answer one client, with an HTTP response if it sent a GET
+static void serveClient()
+{
+    int client = accept(listenFd, NULL, NULL);
+    if (client < 0) return;
+
+    char request[512];
+    int n = 0;
+    struct pollfd pfd = {.fd = client, .events = POLLIN};
+    if (poll(&pfd, 1, METRICS_REQUEST_MS) > 0) n = recv(client, request, sizeof(request), 0);
+
+    static char text[METRICS_TEXT_SIZE];
+    size_t length = formatMetrics(text, sizeof(text));
+
+    if (n >= 4 && memcmp(request, "GET ", 4) == 0) {
+        char header[160];
+        int headerLength = snprintf(header, sizeof(header),
+                                    "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                    "Content-Length: %zu\r\n\r\n", length);
+        if (sendAll(client, header, headerLength) != 1) length = 0;
+    }
+
+    sendAll(client, text, length);
+    close(client);
+}
+
+// Replace the metrics file, so readers never see it half written
+static void writeFile()
+{
+    char text[METRICS_TEXT_SIZE];
+    char tmpPath[sizeof(filePath) + 4];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", filePath);
+
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+
+    size_t length = formatMetrics(text, sizeof(text));
+    int ok = write(fd, text, length) == (ssize_t) length;
+    close(fd);
+
+    if (ok) rename(tmpPath, filePath);
+    else unlink(tmpPath);
+}
+
+static void *serverThread(void *arg)
+{
+    uint64_t nextFile = monotonicNs();
+
+    while (TRUE) {
+        int timeout = -1;
+        if (filePath[0] != '\0') {
+            uint64_t now = monotonicNs();
+            if (now >= nextFile) {
+                writeFile();
+                nextFile = now + METRICS_FILE_PERIOD_MS * 1000000ULL;
+            }
+            timeout = (nextFile - now) / 1000000 + 1;
+        }
+
+        struct pollfd pfd = {.fd = listenFd, .events = POLLIN};
+        if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN)) serveClient();
+    }
+
+    return NULL;
+}
+
+// The last state goes to the file, and the socket goes away
+static void metricsStop()
+{
+    if (filePath[0] != '\0') writeFile();
+    if (listenFd >= 0) unlink(socketPath);
+}
+
+static int openSocket(const char *path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("[ERROR] Metrics error: The socket path '%s' is too long\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    strcpy(socketPath, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    // a socket left behind by an earlier run
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) == -1 || listen(fd, 4) == -1) {
+        perror("metrics socket");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int metricsStart(const char *socketName, const char *fileName)
+{
+    if (socketName == NULL && fileName == NULL) return 1;
+
+    if (fileName != NULL && snprintf(filePath, sizeof(filePath), "%s", fileName) >= (int) sizeof(filePath)) {
+        printf("[ERROR] Metrics error: The file path '%s' is too long\n", fileName);
+        return -1;
+    }
+    if (socketName != NULL && (listenFd = openSocket(socketName)) < 0) return -1;
+
+    // like the log writer, the server leaves every signal to the link thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int result = pthread_create(&server, NULL, serverThread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (result != 0) {
+        printf("[ERROR] Metrics error: Unable to start the metrics server\n");
+        return -1;
+    }
+
+    atexit(metricsStop);
+    return 1;
+}
+
+#endif // LL_NO_HEAP
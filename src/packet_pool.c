@@ -0,0 +1,65 @@
+// Packet pool implementation
+
+#include "packet_pool.h"
+
+#include <stdlib.h>
+
+static unsigned char arena[POOL_SLOTS][POOL_SLOT_SIZE] __attribute__((aligned(16)));
+
+// Stack of free slot indexes, built on first use
+static int freeSlots[POOL_SLOTS];
+static int nFree = -1;
+
+PoolStatistics poolStatistics = {0, 0, 0, 0};
+
+/**
+ * @brief Build the free slot stack the first time the pool is used.
+ */
+static void poolInit()
+{
+    if (nFree >= 0) return;
+
+    for (int i = 0; i < POOL_SLOTS; i++) freeSlots[i] = POOL_SLOTS - 1 - i;
+    nFree = POOL_SLOTS;
+}
+
+void *poolAlloc(size_t size)
+{
+    poolInit();
+
+    if (size <= POOL_SLOT_SIZE && nFree > 0) {
+        poolStatistics.hits++;
+        if (++poolStatistics.inUse > poolStatistics.peak) poolStatistics.peak = poolStatistics.inUse;
+
+        return arena[freeSlots[--nFree]];
+    }
+
+    poolStatistics.misses++;
+#ifdef LL_NO_HEAP
+    return NULL;
+#else
+    return malloc(size);
+#endif
+}
+
+void poolFree(void *buffer)
+{
+    unsigned char *p = buffer;
+    if (p == NULL) return;
+
+    if (p >= arena[0] && p < arena[0] + sizeof(arena)) {
+        freeSlots[nFree++] = (p - arena[0]) / POOL_SLOT_SIZE;
+        poolStatistics.inUse--;
+        return;
+    }
+
+#ifndef LL_NO_HEAP
+    free(buffer);
+#endif
+}
+
+int poolAvailable()
+{
+    poolInit();
+    return nFree;
+}
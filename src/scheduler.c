@@ -0,0 +1,153 @@
+// Packet scheduler implementation
+
+#include "scheduler.h"
+#include "packet_pool.h"
+#include "log.h"
+
+typedef struct {
+    unsigned char *packets[SCHED_QUEUE_SIZE];
+    int sizes[SCHED_QUEUE_SIZE];
+    int head;
+    int count;
+    int priority;
+    int weight;
+    int deficit;
+    ChannelHandler handler;
+} Channel;
+
+// By default the control channel preempts the file channel
+static Channel channels[N_CHANNELS] = {
+    [CH_FILE] = {.priority = 1, .weight = 1},
+    [CH_CONTROL] = {.priority = 0, .weight = 1},
+};
+
+static int lastServed = N_CHANNELS - 1;
+
+static SchedulerPoll pollHook = NULL;
+static int polling = FALSE;
+
+int schedulerSetChannel(unsigned char channel, int priority, int weight)
+{
+    if (channel >= N_CHANNELS || priority < 0 || weight < 1) return -1;
+
+    channels[channel].priority = priority;
+    channels[channel].weight = weight;
+    channels[channel].deficit = 0;
+
+    return 1;
+}
+
+int schedulerEnqueue(unsigned char *packet, int size)
+{
+    if (packet == NULL || size < 2 || size > SCHED_PACKET_SIZE) return -1;
+    if (packet[1] >= N_CHANNELS) return -1;
+
+    Channel *ch = &channels[packet[1]];
+    if (ch->count == SCHED_QUEUE_SIZE) return 0;
+
+    int tail = (ch->head + ch->count) % SCHED_QUEUE_SIZE;
+    ch->packets[tail] = packet;
+    ch->sizes[tail] = size;
+    ch->count++;
+
+    return 1;
+}
+
+int schedulerPending(unsigned char channel)
+{
+    if (channel >= N_CHANNELS) return 0;
+    return channels[channel].count;
+}
+
+/**
+ * @brief Pick the channel whose head packet goes out next.
+ *
+ * Only the most urgent priority level with queued packets competes, so a
+ * high-priority packet never waits for more than the frame already in flight.
+ * Inside that level, channels are served by deficit round robin: each visit
+ * adds weight * SCHED_PACKET_SIZE bytes of credit and a packet is sent only
+ * when the channel has credit for it.
+ *
+ * @return int The chosen channel, or -1 if every queue is empty.
+ */
+static int pickChannel()
+{
+    int best = -1;
+    for (int i = 0; i < N_CHANNELS; i++) {
+        if (channels[i].count == 0) continue;
+        if (best == -1 || channels[i].priority < best) best = channels[i].priority;
+    }
+    if (best == -1) return -1;
+
+    for (;;) {
+        for (int n = 1; n <= N_CHANNELS; n++) {
+            int i = (lastServed + n) % N_CHANNELS;
+            Channel *ch = &channels[i];
+            if (ch->count == 0 || ch->priority != best) continue;
+
+            if (ch->deficit < ch->sizes[ch->head]) {
+                ch->deficit += ch->weight * SCHED_PACKET_SIZE;
+                continue;
+            }
+
+            ch->deficit -= ch->sizes[ch->head];
+            lastServed = i;
+            return i;
+        }
+    }
+}
+
+void schedulerSetPoll(SchedulerPoll poll)
+{
+    pollHook = poll;
+}
+
+int schedulerSendNext()
+{
+    // the hook may queue packets itself, but is never reentered
+    if (pollHook != NULL && !polling) {
+        polling = TRUE;
+        pollHook();
+        polling = FALSE;
+    }
+
+    int i = pickChannel();
+    if (i == -1) return 0;
+
+    Channel *ch = &channels[i];
+    int result = llwrite(ch->packets[ch->head], ch->sizes[ch->head]);
+    if (result < 0) return -1;
+
+    poolFree(ch->packets[ch->head]);
+    ch->head = (ch->head + 1) % SCHED_QUEUE_SIZE;
+    if (--ch->count == 0) ch->deficit = 0;
+
+    return result;
+}
+
+int schedulerFlush()
+{
+    int result;
+    while ((result = schedulerSendNext()) > 0);
+
+    return result == 0 ? 1 : -1;
+}
+
+int schedulerSetHandler(unsigned char channel, ChannelHandler handler)
+{
+    if (channel >= N_CHANNELS) return -1;
+
+    channels[channel].handler = handler;
+    return 1;
+}
+
+int schedulerDispatch(unsigned char *packet, int size)
+{
+    if (packet == NULL || size < 2) return -1;
+    if (packet[1] >= N_CHANNELS || channels[packet[1]].handler == NULL) {
+        logMessage(LOG_LEVEL_WARNING, "[ALERT] Packet for unknown channel %d discarded\n", packet[1]);
+        return 0;
+    }
+
+    return channels[packet[1]].handler(packet, size);
+}
@@ -2,6 +2,8 @@
 // DO NOT CHANGE THIS FILE
 
 #include "serial_port.h"
+#include "serial_speed.h"
+#include "transport.h"
 
 #include <fcntl.h>
 #include <stdio.h>
@@ -17,9 +19,15 @@
 int fd = -1;           // File descriptor for open serial port
 struct termios oldtio; // Serial port settings to restore on closing
 
+static const Transport *transport = &ttyTransport;
+
+////////////////////////////////////////////////
+// TTY TRANSPORT
+////////////////////////////////////////////////
+
 // Open and configure the serial port.
 // Returns -1 on error.
-int openSerialPort(const char *serialPort, int baudRate)
+static int ttyOpen(const char *serialPort, int baudRate)
 {
     // Open with O_NONBLOCK to avoid hanging when CLOCAL
     // is not yet set on the serial port (changed later)
@@ -38,8 +46,17 @@ int openSerialPort(const char *serialPort, int baudRate)
         return -1;
     }
 
-    // Convert baud rate to appropriate flag
+    if (!serialBaudRateValid(baudRate))
+    {
+        fprintf(stderr, "Unsupported baud rate (must be between %d and %d)\n", SERIAL_BAUD_MIN, SERIAL_BAUD_MAX);
+        close(fd);
+        return -1;
+    }
+
+    // Convert baud rate to appropriate flag; any other rate is set
+    // afterwards with BOTHER
     tcflag_t br;
+    int custom = 0;
     switch (baudRate)
     {
     case 1200:
@@ -69,9 +86,40 @@ int openSerialPort(const char *serialPort, int baudRate)
     case 115200:
         br = B115200;
         break;
+#ifdef B230400
+    case 230400:
+        br = B230400;
+        break;
+#endif
+#ifdef B460800
+    case 460800:
+        br = B460800;
+        break;
+#endif
+#ifdef B921600
+    case 921600:
+        br = B921600;
+        break;
+#endif
+#ifdef B1000000
+    case 1000000:
+        br = B1000000;
+        break;
+#endif
+#ifdef B2000000
+    case 2000000:
+        br = B2000000;
+        break;
+#endif
+#ifdef B4000000
+    case 4000000:
+        br = B4000000;
+        break;
+#endif
     default:
-        fprintf(stderr, "Unsupported baud rate (must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600, 115200)\n");
-        return -1;
+        br = B38400; // replaced below
+        custom = 1;
+        break;
     }
 
     // New port settings
@@ -98,6 +146,24 @@ int openSerialPort(const char *serialPort, int baudRate)
         return -1;
     }
 
+    if (custom)
+    {
+        int actual = serialSetCustomSpeed(fd, baudRate);
+        if (actual < 0)
+        {
+            close(fd);
+            return -1;
+        }
+
+        double deviation = 100.0 * (actual - baudRate) / baudRate;
+        if (deviation > SERIAL_BAUD_TOLERANCE || deviation < -SERIAL_BAUD_TOLERANCE)
+        {
+            fprintf(stderr, "Unsupported baud rate %d (the device runs at %d)\n", baudRate, actual);
+            close(fd);
+            return -1;
+        }
+    }
+
     // Clear O_NONBLOCK flag to ensure blocking reads
     oflags ^= O_NONBLOCK;
     if (fcntl(fd, F_SETFL, oflags) == -1)
@@ -113,7 +179,7 @@ int openSerialPort(const char *serialPort, int baudRate)
 
 // Restore original port settings and close the serial port.
 // Returns -1 on error.
-int closeSerialPort()
+static int ttyClose()
 {
     // Restore the old port settings
     if (tcsetattr(fd, TCSANOW, &oldtio) == -1)
@@ -125,12 +191,51 @@ int closeSerialPort()
     return close(fd);
 }
 
+static int ttyRead(unsigned char *bytes, int numBytes)
+{
+    return read(fd, bytes, numBytes);
+}
+
+static int ttyWrite(const unsigned char *bytes, int numBytes)
+{
+    return write(fd, bytes, numBytes);
+}
+
+const Transport ttyTransport = {"tty", ttyOpen, ttyClose, ttyRead, ttyWrite};
+
+////////////////////////////////////////////////
+// SERIAL PORT INTERFACE
+////////////////////////////////////////////////
+
+// Open the transport named by serialPort (see transport.h).
+// Returns -1 on error.
+int openSerialPort(const char *serialPort, int baudRate)
+{
+    transport = transportFor(serialPort);
+    return transport->open(serialPort, baudRate);
+}
+
+// Restore original port settings and close the serial port.
+// Returns -1 on error.
+int closeSerialPort()
+{
+    return transport->close();
+}
+
 // Wait up to 0.1 second (VTIME) for a byte received from the serial port (must
 // check whether a byte was actually received from the return value).
 // Returns -1 on error, 0 if no byte was received, 1 if a byte was received.
 int readByteSerialPort(unsigned char *byte)
 {
-    return read(fd, byte, 1);
+    return transport->read(byte, 1);
+}
+
+// Read up to numBytes already received from the serial port (must check how
+// many were actually read from the return value).
+// Returns -1 on error, otherwise the number of bytes read (0 if none).
+int readBytesSerialPort(unsigned char *bytes, int numBytes)
+{
+    return transport->read(bytes, numBytes);
 }
 
 // Write up to numBytes to the serial port (must check how many were actually
@@ -138,5 +243,5 @@ int readByteSerialPort(unsigned char *byte)
 // Returns -1 on error, otherwise the number of bytes written.
 int writeBytesSerialPort(const unsigned char *bytes, int numBytes)
 {
-    return write(fd, bytes, numBytes);
+    return transport->write(bytes, numBytes);
 }
@@ -0,0 +1,61 @@
+// Serial port speed implementation
+
+#include "serial_speed.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#endif
+
+int serialBaudRateValid(int baudRate)
+{
+    return baudRate >= SERIAL_BAUD_MIN && baudRate <= SERIAL_BAUD_MAX;
+}
+
+#ifdef __linux__
+
+int serialSetCustomSpeed(int fd, int baudRate)
+{
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) == -1)
+    {
+        perror("TCGETS2");
+        return -1;
+    }
+
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER;
+    tio.c_cflag &= ~(CBAUD << IBSHIFT);
+    tio.c_cflag |= BOTHER << IBSHIFT;
+    tio.c_ispeed = baudRate;
+    tio.c_ospeed = baudRate;
+
+    if (ioctl(fd, TCSETS2, &tio) == -1)
+    {
+        perror("TCSETS2");
+        return -1;
+    }
+
+    // The driver writes back the rate its divisor really gives
+    if (ioctl(fd, TCGETS2, &tio) == -1)
+    {
+        perror("TCGETS2");
+        return -1;
+    }
+
+    return tio.c_ospeed;
+}
+
+#else
+
+int serialSetCustomSpeed(int fd, int baudRate)
+{
+    fprintf(stderr, "Custom baud rates need termios2, which this system lacks\n");
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include "statistics.h"
 
+LinkFaults faults = {TPROPAGATION, BCC1_ERROR, BCC2_ERROR, 0};
+
 // Calculate the difference between two timeval structs in seconds.
 double timeDiff(struct timeval start, struct timeval end) {
     return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
@@ -7,18 +9,19 @@ double timeDiff(struct timeval start, struct timeval end) {
 
 // a
 double propagation_to_transmission_ratio(int baudrate, int maxPayload) {
-    return ((double) TPROPAGATION / 1000.0) / ((double) maxPayload * 8.0 / (double) baudrate);
+    return (faults.propagationMs / 1000.0) / ((double) maxPayload * 8.0 / (double) baudrate);
 }
 
-double received_bit_rate(Statistics stats) {
-    return (double) (FILESIZE * 8) / timeDiff(stats.startTime, stats.endTime);
+double received_bit_rate(const Statistics *stats) {
+    double seconds = timeDiff(stats->startTime, stats->endTime);
+    return seconds > 0 ? (double) stats->payloadBytes * 8.0 / seconds : 0;
 }
 
 // FER = P(bcc1 error) + P(bcc2 error) * (1 - P(bcc1 error))
 // probability of any error in either BCC1 or BCC2
 double fer() {
-    double bcc1_error_rate = (double) BCC1_ERROR / 100.0;
-    double bcc2_error_rate = (double) BCC2_ERROR / 100.0;
+    double bcc1_error_rate = faults.bcc1Error / 100.0;
+    double bcc2_error_rate = faults.bcc2Error / 100.0;
     return bcc1_error_rate + bcc2_error_rate * (1 - bcc1_error_rate);
 }
 
@@ -30,6 +33,43 @@ double optimal_efficiency(int baudrate, int maxPayload) {
 }
 
 // Actual Efficiency =  Actual Received Bitrate / Link Capacity
-double actual_efficiency(Statistics stats, int baudrate) {
+double actual_efficiency(const Statistics *stats, int baudrate) {
     return (double) (received_bit_rate(stats) / baudrate);
+}
+
+uint64_t total_link_bytes(const Statistics *stats) {
+    return stats->payloadBytes + stats->headerBytes + stats->stuffingBytes +
+           stats->retransmittedBytes + stats->supervisionBytes;
+}
+
+void rateRecord(RateWindow *rate, uint64_t bytes, uint64_t nowNs) {
+    uint64_t second = nowNs / 1000000000ULL;
+    int i = second % RATE_WINDOW_S;
+
+    if (rate->startNs == 0) rate->startNs = nowNs;
+
+    // the bucket last held an older second
+    if (rate->second[i] != second) {
+        rate->second[i] = second;
+        rate->bytes[i] = 0;
+    }
+    rate->bytes[i] += bytes;
+}
+
+// The current second is still filling, so the window is the RATE_WINDOW_S - 1
+// complete seconds before it plus the elapsed part of the current one, or the
+// time since the first record if that is shorter
+double rateBytesPerSecond(const RateWindow *rate, uint64_t nowNs) {
+    uint64_t second = nowNs / 1000000000ULL;
+    uint64_t bytes = 0;
+
+    for (int i = 0; i < RATE_WINDOW_S; i++) {
+        if (rate->second[i] + RATE_WINDOW_S > second) bytes += rate->bytes[i];
+    }
+
+    double seconds = RATE_WINDOW_S - 1 + (nowNs % 1000000000ULL) / 1e9;
+    double elapsed = (nowNs - rate->startNs) / 1e9;
+    if (elapsed < seconds) seconds = elapsed;
+
+    return seconds > 0 ? bytes / seconds : 0;
 }
\ No newline at end of file
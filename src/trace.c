@@ -0,0 +1,153 @@
+// Link trace implementation
+
+#include "trace.h"
+#include "histogram.h"
+#include "link_layer.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Slots left out of a flush, so events appended by a signal handler while the
+// ring is being written can't overwrite the oldest ones being copied
+#define TRACE_FLUSH_SLACK 64
+
+// Events copied per write
+#define TRACE_FLUSH_BATCH 256
+
+int traceEnabled = FALSE;
+
+static TraceEvent ring[TRACE_EVENTS];
+static atomic_uint_fast64_t head = 0; // number of events ever appended
+static char tracePath[256];
+static TraceHeader header = {TRACE_MAGIC, sizeof(TraceEvent), 0, 0, MAX_PAYLOAD_SIZE, 0, 0};
+
+void traceAppend(uint8_t type, uint8_t A, uint8_t C, uint8_t seq, int32_t arg)
+{
+    uint64_t i = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed);
+    TraceEvent *event = &ring[i & (TRACE_EVENTS - 1)];
+
+    // a flush skips the slot until its type is set again
+    __atomic_store_n(&event->type, 0, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+    event->ns = monotonicNs();
+    event->arg = arg;
+    event->A = A;
+    event->C = C;
+    event->seq = seq;
+
+    __atomic_store_n(&event->type, type, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Write all of buf, retrying short writes.
+ *
+ * @return int 1 on success, -1 on error.
+ */
+static int writeAll(int fd, const void *buf, size_t size)
+{
+    const char *p = buf;
+
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n <= 0) return -1;
+        p += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+int traceFlush()
+{
+    if (!traceEnabled) return -1;
+
+    uint64_t end = atomic_load_explicit(&head, memory_order_acquire);
+    uint64_t start = end > TRACE_EVENTS - TRACE_FLUSH_SLACK ? end - (TRACE_EVENTS - TRACE_FLUSH_SLACK) : 0;
+
+    int fd = open(tracePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    // the header is written again once the events are counted
+    TraceHeader h = header;
+    h.lost = start;
+    int result = writeAll(fd, &h, sizeof(h));
+
+    TraceEvent batch[TRACE_FLUSH_BATCH];
+    int n = 0;
+
+    for (uint64_t i = start; i < end && result == 1; i++) {
+        const TraceEvent *event = &ring[i & (TRACE_EVENTS - 1)];
+        if (__atomic_load_n(&event->type, __ATOMIC_ACQUIRE) == 0) continue;
+
+        batch[n++] = *event;
+        h.count++;
+        if (n == TRACE_FLUSH_BATCH) {
+            result = writeAll(fd, batch, n * sizeof(TraceEvent));
+            n = 0;
+        }
+    }
+
+    if (result == 1 && n > 0) result = writeAll(fd, batch, n * sizeof(TraceEvent));
+    if (result == 1 && lseek(fd, 0, SEEK_SET) == 0) result = writeAll(fd, &h, sizeof(h));
+
+    close(fd);
+    return result;
+}
+
+void traceSetLink(int role, int baudRate)
+{
+    header.role = role;
+    header.baudRate = baudRate;
+}
+
+// SIGUSR1 writes a snapshot, SIGINT and SIGTERM write the trace and then
+// terminate as they would have
+static void traceSignalHandler(int signal)
+{
+    traceFlush();
+    if (signal == SIGUSR1) return;
+
+    struct sigaction action = {0};
+    action.sa_handler = SIG_DFL;
+    sigaction(signal, &action, NULL);
+    raise(signal);
+}
+
+static void traceFlushAtExit()
+{
+    traceFlush();
+}
+
+int traceStart(const char *path)
+{
+    if (path == NULL || snprintf(tracePath, sizeof(tracePath), "%s", path) >= (int) sizeof(tracePath)) {
+        printf("[ERROR] Trace error: Invalid trace file name\n");
+        return -1;
+    }
+
+    int fd = open(tracePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("[ERROR] Trace error: Unable to open '%s' for writing\n", tracePath);
+        return -1;
+    }
+    close(fd);
+
+    struct sigaction action = {0};
+    action.sa_handler = traceSignalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    if (!traceEnabled) atexit(traceFlushAtExit);
+    traceEnabled = TRUE;
+
+    return 1;
+}
@@ -0,0 +1,357 @@
+// Transport implementation: pty, socket, shared-memory and fd transports
+
+#define _GNU_SOURCE // posix_openpt, ptsname
+
+#include "transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+// One direction of the shared-memory link. Only the writer moves head and
+// only the reader moves tail, so no lock is needed.
+typedef struct {
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    _Alignas(64) unsigned char data[SHM_RING_SIZE];
+} Ring;
+
+typedef struct {
+    Ring rings[2];        // rings[i] carries the bytes written by end i
+    atomic_int pids[2];   // process that opened each end (0 until then)
+    atomic_int closed[2]; // set when an end is closed
+} ShmLink;
+
+static int pairFds[2] = {-1, -1}; // pty or socket pair
+static int fd = -1;               // end in use
+static int fdIsSocket = 0;        // written with send, so a closed peer can't raise SIGPIPE
+static ShmLink *shmLink = NULL;
+static int shmEnd = 0;
+
+/**
+ * @brief Parse the end number after the "<kind>:" prefix of an address.
+ *
+ * @return int The end (0 or 1), or -1 if the address names neither.
+ */
+static int parseEnd(const char *address)
+{
+    const char *end = strchr(address, ':');
+    if (end == NULL || (strcmp(end + 1, "0") != 0 && strcmp(end + 1, "1") != 0)) {
+        printf("[ERROR] Transport error: '%s' does not name end 0 or 1 of a pair\n", address);
+        return -1;
+    }
+
+    return end[1] - '0';
+}
+
+////////////////////////////////////////////////
+// FILE DESCRIPTORS (PTY, SOCKET, FD)
+////////////////////////////////////////////////
+
+static int setNonBlocking(int descriptor)
+{
+    int flags = fcntl(descriptor, F_GETFL);
+    return flags == -1 ? -1 : fcntl(descriptor, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Use descriptor as the end of the link
+static int useFd(int descriptor)
+{
+    struct stat st;
+    fd = descriptor;
+    fdIsSocket = fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+    return fd;
+}
+
+static int pairOpen(const char *address, int baudRate)
+{
+    int end = parseEnd(address);
+    if (end == -1) return -1;
+    if (pairFds[end] == -1) {
+        printf("[ERROR] Transport error: No pair was created for '%s'\n", address);
+        return -1;
+    }
+
+    // the other end belongs to the peer
+    useFd(pairFds[end]);
+    if (pairFds[!end] != -1) close(pairFds[!end]);
+    pairFds[0] = pairFds[1] = -1;
+
+    return fd;
+}
+
+static int pairClose()
+{
+    int result = close(fd);
+    fd = -1;
+    return result;
+}
+
+static int pairRead(unsigned char *bytes, int numBytes)
+{
+    int n = read(fd, bytes, numBytes);
+
+    // nothing yet: let the peer run, which matters on a single CPU
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        sched_yield();
+        return 0;
+    }
+
+    return n;
+}
+
+static int pairWrite(const unsigned char *bytes, int numBytes)
+{
+    int written = 0;
+
+    while (written < numBytes) {
+        int n = fdIsSocket ? send(fd, bytes + written, numBytes - written, MSG_NOSIGNAL)
+                           : write(fd, bytes + written, numBytes - written);
+        if (n >= 0) {
+            written += n;
+            continue;
+        }
+        if (errno == EPIPE || errno == ECONNRESET) return TRANSPORT_PEER_CLOSED;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+        struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+        poll(&pfd, 1, -1);
+    }
+
+    return written;
+}
+
+/**
+ * @brief Create a pseudo-terminal in raw mode, so the bytes cross the kernel's
+ * tty layer as on a real port. End 0 is the slave and end 1 the master.
+ * Closing the master hangs up the slave and drops the bytes it has not read
+ * yet, so the master goes to the receiver, which closes last.
+ *
+ * @return int Returns 1 on success, -1 on error.
+ */
+static int ptyPair()
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+        perror("posix_openpt");
+        if (master != -1) close(master);
+        return -1;
+    }
+
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave == -1 || tcgetattr(slave, &tio) == -1) {
+        perror("pty");
+        close(master);
+        if (slave != -1) close(slave);
+        return -1;
+    }
+
+    cfmakeraw(&tio);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(slave, TCSANOW, &tio);
+
+    setNonBlocking(master);
+    setNonBlocking(slave);
+    pairFds[0] = slave;
+    pairFds[1] = master;
+    return 1;
+}
+
+static int socketPair()
+{
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pairFds) == -1) {
+        perror("socketpair");
+        pairFds[0] = pairFds[1] = -1;
+        return -1;
+    }
+
+    setNonBlocking(pairFds[0]);
+    setNonBlocking(pairFds[1]);
+    return 1;
+}
+
+static int fdOpen(const char *address, int baudRate)
+{
+    char *end;
+    long n = strtol(address + 3, &end, 10);
+    if (end == address + 3 || *end != '\0' || n < 0 || fcntl(n, F_GETFL) == -1) {
+        printf("[ERROR] Transport error: '%s' is not an open file descriptor\n", address);
+        return -1;
+    }
+
+    useFd(n);
+    setNonBlocking(fd);
+    return fd;
+}
+
+const Transport ptyTransport = {"pty", pairOpen, pairClose, pairRead, pairWrite};
+const Transport socketTransport = {"socket", pairOpen, pairClose, pairRead, pairWrite};
+const Transport fdTransport = {"fd", fdOpen, pairClose, pairRead, pairWrite};
+
+////////////////////////////////////////////////
+// SHARED-MEMORY RING
+////////////////////////////////////////////////
+
+static int shmOpen(const char *address, int baudRate)
+{
+    int end = parseEnd(address);
+    if (end == -1) return -1;
+    if (shmLink == NULL) {
+        printf("[ERROR] Transport error: No pair was created for '%s'\n", address);
+        return -1;
+    }
+
+    shmEnd = end;
+    atomic_store(&shmLink->pids[end], getpid());
+    atomic_store(&shmLink->closed[end], 0);
+    return 0;
+}
+
+static int shmClose()
+{
+    atomic_store(&shmLink->closed[shmEnd], 1);
+    int result = munmap(shmLink, sizeof(ShmLink));
+    shmLink = NULL;
+    return result;
+}
+
+static int shmRead(unsigned char *bytes, int numBytes)
+{
+    Ring *ring = &shmLink->rings[!shmEnd];
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    unsigned int n = head - tail;
+    if (n == 0) {
+        sched_yield();
+        return 0;
+    }
+    if (n > (unsigned int) numBytes) n = numBytes;
+
+    unsigned int pos = tail % SHM_RING_SIZE;
+    unsigned int first = SHM_RING_SIZE - pos < n ? SHM_RING_SIZE - pos : n;
+    memcpy(bytes, ring->data + pos, first);
+    memcpy(bytes + first, ring->data, n - first);
+
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
+
+/**
+ * @brief Whether the peer's end is gone: closed, or its process has exited
+ * without closing it.
+ */
+static int shmPeerGone()
+{
+    int peer = atomic_load(&shmLink->pids[!shmEnd]);
+
+    if (atomic_load(&shmLink->closed[!shmEnd])) return 1;
+    return peer > 0 && kill(peer, 0) == -1 && errno == ESRCH;
+}
+
+static int shmWrite(const unsigned char *bytes, int numBytes)
+{
+    Ring *ring = &shmLink->rings[shmEnd];
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    int written = 0;
+
+    while (written < numBytes) {
+        unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        unsigned int n = SHM_RING_SIZE - (head - tail);
+        if (n == 0) {
+            // a full ring only drains while the peer is there to read it
+            if (shmPeerGone()) return TRANSPORT_PEER_CLOSED;
+            sched_yield();
+            continue;
+        }
+        if (n > (unsigned int) (numBytes - written)) n = numBytes - written;
+
+        unsigned int pos = head % SHM_RING_SIZE;
+        unsigned int first = SHM_RING_SIZE - pos < n ? SHM_RING_SIZE - pos : n;
+        memcpy(ring->data + pos, bytes + written, first);
+        memcpy(ring->data, bytes + written + first, n - first);
+
+        head += n;
+        written += n;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+
+    return written;
+}
+
+/**
+ * @brief Map the two rings shared by both ends. The mapping is anonymous and
+ * shared, so it is inherited across fork.
+ *
+ * @return int Returns 1 on success, -1 on error.
+ */
+static int shmPair()
+{
+    void *link = mmap(NULL, sizeof(ShmLink), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (link == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    shmLink = link;
+    return 1;
+}
+
+const Transport shmTransport = {"shm", shmOpen, shmClose, shmRead, shmWrite};
+
+////////////////////////////////////////////////
+// SELECTION
+////////////////////////////////////////////////
+
+// Transports added at runtime come first, the built-in ones after them
+#define MAX_TRANSPORTS 8
+
+static const Transport *prefixed[MAX_TRANSPORTS] = {&ptyTransport, &socketTransport, &shmTransport, &fdTransport};
+static int nPrefixed = 4;
+
+const Transport *transportFor(const char *address)
+{
+    for (int i = 0; i < nPrefixed; i++) {
+        size_t len = strlen(prefixed[i]->name);
+        if (strncmp(address, prefixed[i]->name, len) == 0 && address[len] == ':') return prefixed[i];
+    }
+
+    return &ttyTransport;
+}
+
+int transportAdd(const Transport *transport)
+{
+    if (transport == NULL || nPrefixed == MAX_TRANSPORTS) return -1;
+
+    memmove(prefixed + 1, prefixed, nPrefixed * sizeof(prefixed[0]));
+    prefixed[0] = transport;
+    nPrefixed++;
+
+    return 1;
+}
+
+int transportPair(const char *kind)
+{
+    if (kind == NULL) return -1;
+
+    if (strcmp(kind, "pty") == 0) return ptyPair();
+    if (strcmp(kind, "socket") == 0) return socketPair();
+    if (strcmp(kind, "shm") == 0) return shmPair();
+
+    printf("[ERROR] Transport error: Unknown transport '%s'\n", kind);
+    return -1;
+}
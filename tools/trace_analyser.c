@@ -0,0 +1,321 @@
+// Link trace analyser.
+// Reads a trace written with --trace=<file> and prints what the link spent
+// its time on: frame counts, the distribution of round trips, per-frame
+// timelines and the stalls that held the transfer up, each with its cause.
+//
+// Usage: trace_analyser [--timeline] [--events] [--stall=<ms>] <trace file>
+//   --timeline: one line per I-frame (when it went out, how often, how long)
+//   --events: every event, as recorded
+//   --stall=<ms>: gaps without progress longer than this are stalls
+//                 (default: 4 times the median gap)
+//
+// On a transmitter trace, progress is an I-frame acknowledged and the round
+// trip runs from the last send of a frame to its RR. Frames that were sent
+// more than once give no round trip sample, since the RR can't be matched to
+// one of the sends. On a receiver trace, progress is a new I-frame taken and
+// the round trip runs from each RR to the next I-frame.
+
+#include "histogram.h"
+#include "link_layer.h"
+#include "protocol.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Stall causes, most telling first: a stall is put down to the first one seen
+enum {
+    CAUSE_SUSPENDED,
+    CAUSE_TIMEOUT,
+    CAUSE_REJECTED,
+    CAUSE_DROPPED,
+    CAUSE_DUPLICATE,
+    CAUSE_SLOW,
+    N_CAUSES
+};
+
+static const char *causeNames[N_CAUSES] = {
+    "link suspended",
+    "timeout (frame or RR lost)",
+    "rejected (bad BCC2)",
+    "dropped (bad header)",
+    "duplicate frames",
+    "no error (slow line or peer)",
+};
+
+static const char *stateNames[] = {"", "opening", "connected", "suspended", "resumed", "closing", "closed"};
+
+static TraceHeader header;
+static TraceEvent *events;
+
+static int isInformation(const TraceEvent *e)
+{
+    return e->A == A_T && (e->C == C_INF(0) || e->C == C_INF(1));
+}
+
+static double ms(uint64_t ns)
+{
+    return ns / 1e6;
+}
+
+// Name of a frame from its control field
+static const char *frameName(unsigned char C, char *name)
+{
+    switch (C) {
+        case C_SET: return "SET";
+        case C_UA: return "UA";
+        case C_DISC: return "DISC";
+        case C_KEEPALIVE: return "KEEPALIVE";
+        case C_INF(0): return "I(0)";
+        case C_INF(1): return "I(1)";
+        case C_RR(0): return "RR(0)";
+        case C_RR(1): return "RR(1)";
+        case C_REJ(0): return "REJ(0)";
+        case C_REJ(1): return "REJ(1)";
+    }
+
+    sprintf(name, "C=0x%02X", C);
+    return name;
+}
+
+static void printEvents()
+{
+    static const char *typeNames[] = {"", "SEND", "RESEND", "RECEIVE", "BAD BCC2", "DROP", "TIMEOUT", "STATE"};
+    char name[16];
+
+    for (uint64_t i = 0; i < header.count; i++) {
+        const TraceEvent *e = &events[i];
+        printf("%12.3f ms  Ns %d Nr %d  %-8s ", ms(e->ns - events[0].ns), e->seq & 1, e->seq >> 1,
+               e->type <= TRACE_STATE ? typeNames[e->type] : "?");
+
+        if (e->type == TRACE_STATE) printf("%s\n", e->arg <= TRACE_CLOSED ? stateNames[e->arg] : "?");
+        else if (e->type == TRACE_DROP) printf("%d frames\n", e->arg);
+        else if (e->type == TRACE_TIMEOUT) printf("alarm #%d\n", e->arg);
+        else if (e->type == TRACE_SEND || e->type == TRACE_RESEND) printf("A=0x%02X %s, %d bytes\n", e->A, frameName(e->C, name), e->arg);
+        else if (e->arg >= 0) printf("A=0x%02X %s, %d data bytes\n", e->A, frameName(e->C, name), e->arg);
+        else printf("A=0x%02X %s\n", e->A, frameName(e->C, name));
+    }
+}
+
+/**
+ * @brief Cause to blame for a gap without progress, from the events in it.
+ *
+ * @param from Index of the first event after the last progress.
+ * @param to Index of the event that made progress again.
+ */
+static int stallCause(uint64_t from, uint64_t to)
+{
+    int cause = CAUSE_SLOW;
+
+    for (uint64_t i = from; i < to; i++) {
+        const TraceEvent *e = &events[i];
+        int c = CAUSE_SLOW;
+
+        if (e->type == TRACE_STATE && e->arg == TRACE_SUSPENDED) c = CAUSE_SUSPENDED;
+        else if (e->type == TRACE_TIMEOUT) c = CAUSE_TIMEOUT;
+        else if (e->type == TRACE_BAD_BCC2 || (e->C == C_REJ(0) || e->C == C_REJ(1))) c = CAUSE_REJECTED;
+        else if (e->type == TRACE_DROP) c = CAUSE_DROPPED;
+        else if (e->type == TRACE_RECEIVE && isInformation(e) && ((e->C != 0) != (e->seq >> 1)) && header.role == LlRx) c = CAUSE_DUPLICATE;
+
+        if (c < cause) cause = c;
+    }
+
+    return cause;
+}
+
+static int compareGaps(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = NULL;
+    int timeline = 0, dump = 0;
+    double stallMs = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--timeline") == 0) timeline = 1;
+        else if (strcmp(argv[i], "--events") == 0) dump = 1;
+        else if (strncmp(argv[i], "--stall=", 8) == 0) stallMs = atof(argv[i] + 8);
+        else if (argv[i][0] != '-' && path == NULL) path = argv[i];
+        else path = NULL, i = argc;
+    }
+
+    if (path == NULL) {
+        printf("Usage: %s [--timeline] [--events] [--stall=<ms>] <trace file>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("[ERROR] Unable to open '%s'\n", path);
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, 8) != 0 ||
+        header.eventSize != sizeof(TraceEvent)) {
+        printf("[ERROR] '%s' is not a link trace\n", path);
+        return 1;
+    }
+
+    events = malloc(header.count * sizeof(TraceEvent) + 1);
+    if (events == NULL || fread(events, sizeof(TraceEvent), header.count, file) != header.count) {
+        printf("[ERROR] The trace '%s' is truncated\n", path);
+        return 1;
+    }
+    fclose(file);
+
+    if (header.count == 0) {
+        printf("The trace is empty\n");
+        return 0;
+    }
+
+    int tx = header.role == LlTx;
+    printf("%s trace: %u baud, %u byte payloads, %llu events (%llu older ones lost), %.3f s\n",
+           tx ? "Transmitter" : "Receiver", header.baudRate, header.maxPayload, (unsigned long long) header.count,
+           (unsigned long long) header.lost, ms(events[header.count - 1].ns - events[0].ns) / 1000);
+
+    if (dump) {
+        printf("\n");
+        printEvents();
+    }
+
+    // Counts, round trips and progress times
+    uint64_t sent = 0, resent = 0, received = 0, bad = 0, dropped = 0, timeouts = 0, rejects = 0;
+    Histogram *rtt = calloc(1, sizeof(Histogram));
+    Histogram *frameTime = calloc(1, sizeof(Histogram));
+    uint64_t *progress = malloc((header.count + 1) * sizeof(uint64_t)); // event index of each progress
+    uint64_t nProgress = 0;
+
+    // outstanding I-frame (transmitter), or time of the last RR (receiver)
+    int open = 0, openC = 0, openSends = 0, openTimeouts = 0, openRejects = 0, openSize = 0;
+    uint64_t firstSend = 0, lastSend = 0, lastRR = 0, frameNumber = 0;
+
+    if (timeline) {
+        printf("\n%6s %12s  %-5s %6s  %s\n", "frame", "start (ms)", "frame", "bytes", tx ? "outcome" : "status");
+    }
+
+    for (uint64_t i = 0; i < header.count; i++) {
+        const TraceEvent *e = &events[i];
+        double t = ms(e->ns - events[0].ns);
+
+        switch (e->type) {
+            case TRACE_SEND:
+                sent++;
+                if (tx && isInformation(e)) {
+                    open = 1;
+                    openC = e->C;
+                    openSends = 1;
+                    openTimeouts = openRejects = 0;
+                    openSize = e->arg;
+                    firstSend = lastSend = e->ns;
+                }
+                if (!tx && e->A == A_R && (e->C == C_RR(0) || e->C == C_RR(1))) lastRR = e->ns;
+                break;
+
+            case TRACE_RESEND:
+                resent++;
+                if (tx && open && e->C == openC) {
+                    openSends++;
+                    lastSend = e->ns;
+                }
+                break;
+
+            case TRACE_BAD_BCC2:
+                bad++;
+                // fall through
+            case TRACE_RECEIVE:
+                received++;
+                if (e->C == C_REJ(0) || e->C == C_REJ(1)) {
+                    rejects++;
+                    if (open) openRejects++;
+                }
+
+                if (tx && open && e->C == C_RR((openC == C_INF(0)))) {
+                    uint64_t took = e->ns - firstSend;
+                    histogramRecord(frameTime, took);
+                    if (openSends == 1) histogramRecord(rtt, e->ns - lastSend);
+                    progress[nProgress++] = i;
+                    open = 0;
+
+                    if (timeline) {
+                        printf("%6llu %12.3f  %-5s %6d  acknowledged after %.3f ms", (unsigned long long) ++frameNumber,
+                               ms(firstSend - events[0].ns), openC ? "I(1)" : "I(0)", openSize, ms(took));
+                        if (openSends > 1) printf(", sent %d times", openSends);
+                        if (openTimeouts > 0) printf(", %d timeouts", openTimeouts);
+                        if (openRejects > 0) printf(", %d REJ", openRejects);
+                        printf("\n");
+                    }
+                }
+
+                if (!tx && isInformation(e)) {
+                    int expected = (e->C == C_INF(1)) == (e->seq >> 1);
+                    int good = expected && e->type == TRACE_RECEIVE;
+
+                    if (lastRR != 0) histogramRecord(rtt, e->ns - lastRR);
+                    lastRR = 0;
+                    if (good) progress[nProgress++] = i;
+
+                    if (timeline) {
+                        printf("%6llu %12.3f  %-5s %6d  %s\n", (unsigned long long) (good ? ++frameNumber : frameNumber), t,
+                               e->C ? "I(1)" : "I(0)", e->arg,
+                               good ? "taken" : !expected ? "duplicate" : "bad BCC2, rejected");
+                    }
+                }
+                break;
+
+            case TRACE_DROP:
+                dropped += e->arg;
+                break;
+
+            case TRACE_TIMEOUT:
+                timeouts++;
+                if (open) openTimeouts++;
+                break;
+
+            case TRACE_STATE:
+                if (e->arg == TRACE_CONNECTED) progress[nProgress++] = i;
+                if (timeline) printf("%6s %12.3f  link %s\n", "", t, e->arg <= TRACE_CLOSED ? stateNames[e->arg] : "?");
+                break;
+        }
+    }
+
+    printf("\nFrames sent: %llu, sent again: %llu, received: %llu (%llu with a bad BCC2), dropped: %llu\n",
+           (unsigned long long) sent, (unsigned long long) resent, (unsigned long long) received,
+           (unsigned long long) bad, (unsigned long long) dropped);
+    printf("Timeouts: %llu, REJ received: %llu\n", (unsigned long long) timeouts, (unsigned long long) rejects);
+
+    printf("\n%31s  %8s %10s %10s %10s %10s %10s\n", "Latency (us)", "count", "mean", "p50", "p90", "p99", "max");
+    histogramPrint(tx ? "Round trip (single send)" : "RR to next I-frame", rtt);
+    if (tx) histogramPrint("First send to ACK", frameTime);
+
+    // Stalls: gaps between progress events well above the usual one
+    if (nProgress < 2) return 0;
+
+    uint64_t *gaps = malloc(nProgress * sizeof(uint64_t));
+    for (uint64_t i = 1; i < nProgress; i++) gaps[i - 1] = events[progress[i]].ns - events[progress[i - 1]].ns;
+    qsort(gaps, nProgress - 1, sizeof(uint64_t), compareGaps);
+
+    uint64_t threshold = stallMs >= 0 ? (uint64_t) (stallMs * 1e6) : 4 * gaps[(nProgress - 1) / 2];
+    uint64_t stalls[N_CAUSES] = {0}, stallNs[N_CAUSES] = {0}, total = 0;
+
+    for (uint64_t i = 1; i < nProgress; i++) {
+        uint64_t gap = events[progress[i]].ns - events[progress[i - 1]].ns;
+        if (gap <= threshold) continue;
+
+        int cause = stallCause(progress[i - 1] + 1, progress[i]);
+        stalls[cause]++;
+        stallNs[cause] += gap;
+        total++;
+    }
+
+    printf("\nStalls (no progress for more than %.3f ms): %llu\n", ms(threshold), (unsigned long long) total);
+    for (int c = 0; c < N_CAUSES; c++) {
+        if (stalls[c] == 0) continue;
+        printf("%31s: %8llu stalls %12.3f ms\n", causeNames[c], (unsigned long long) stalls[c], ms(stallNs[c]));
+    }
+
+    return 0;
+}